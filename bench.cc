@@ -0,0 +1,678 @@
+#include "defs.h"
+#include "forces.h"
+#include "nbody.h"
+#include "integrators.h"
+#include "parallel.h"
+#include "simulation.h"
+#include "memory.h"
+
+#include <vector>
+#include <random>
+#include <chrono>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+// headless benchmarks for the physics, no window needed
+//   ./bench nbody [bodies] [theta]
+//   ./bench energy [bodies] [steps] [dt] [tolerance]
+//   ./bench morton [balls] [steps]
+//   ./bench sort [count]
+//   ./bench pairs [balls] [max threads]
+//   ./bench memory [balls] [steps] [json file, - for stdout] [nbody]
+//   ./bench meshqueue
+
+double Seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void CreateBodies(std::vector<Raylib::Circle>& balls, const int num_balls, const float extent)
+{
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<float> pos(0.0f, extent);
+    std::uniform_real_distribution<float> radius(1.0f, 4.0f);
+
+    for (int i = 0; i < num_balls; ++i)
+    {
+        Raylib::Circle ball;
+        ball.CreateCircle(0, 0, radius(gen), WHITE);
+        ball.position = Vector2{ pos(gen), pos(gen) };
+        ball.velocity = Vector2{ 0.0f, 0.0f };
+        balls.push_back(ball);
+    }
+}
+
+// Barnes-Hut against the brute force reference for accuracy and speed
+void BenchNBody(const int num_bodies, const float theta)
+{
+    std::vector<Raylib::Circle> balls;
+    CreateBodies(balls, num_bodies, 8192.0f);
+
+    Physics::NBodySettings settings;
+    settings.enabled = true;
+    settings.G = 1.0f;
+    settings.theta = theta;
+    settings.softening = 1.0f;
+
+    Physics::QuadTree tree;
+    std::vector<Vector2> reference(num_bodies, Vector2{ 0.0f, 0.0f });
+    std::vector<Vector2> approx(num_bodies, Vector2{ 0.0f, 0.0f });
+
+    auto start = std::chrono::steady_clock::now();
+    Physics::AddBruteForceGravity(settings, balls, reference);
+    double brute_time = Seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    Physics::BuildQuadTree(tree, balls);
+    double build_time = Seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    Physics::AddBarnesHutGravity(settings, tree, balls, approx);
+    double walk_time = Seconds(start);
+
+    Physics::GravityError err = Physics::CompareGravity(reference, approx);
+
+    std::cout << "nbody: " << num_bodies << " bodies, theta " << theta << ", " << Parallel::ThreadCount() << " threads" << std::endl;
+    std::cout << "  brute force:  " << brute_time * 1000.0 << " ms" << std::endl;
+    std::cout << "  barnes-hut:   " << (build_time + walk_time) * 1000.0 << " ms (build " << build_time * 1000.0
+              << " ms, walk " << walk_time * 1000.0 << " ms, " << tree.nodes.size() << " nodes)" << std::endl;
+    std::cout << "  rel. error:   rms " << err.rms << ", max " << err.max << std::endl;
+}
+
+// total energy of a set of unit mass balls in the conservative force fields
+double TotalEnergy(const Physics::ForceSet& forces, const std::vector<Raylib::Circle>& balls)
+{
+    double energy = 0.0;
+
+    for (int i = 0; i < balls.size(); ++i)
+    {
+        energy += 0.5 * Vector2LengthSqr(balls[i].velocity) + Physics::ForceFieldPotential(forces, balls[i].position);
+    }
+
+    return energy;
+}
+
+typedef struct EnergyResult
+{
+    const char* name;
+    double ms_per_step;
+    double final_drift;         // |E_end - E_start| / |E_start|
+    double max_drift;
+
+} EnergyResult;
+
+template <typename Integrator>
+EnergyResult RunEnergy(const Physics::ForceSet& forces, std::vector<Raylib::Circle> balls, const int steps, const float dt)
+{
+    Physics::IntegratorState<Raylib::Circle> state;
+    auto accel_fn = [&](const std::vector<Raylib::Circle>& b, std::vector<Vector2>& accel)
+    {
+        Physics::ComputeAccelerations<Physics::FEATURE_FIELDS>(forces, b, accel);
+    };
+
+    const double start_energy = TotalEnergy(forces, balls);
+    EnergyResult result = { Integrator::name, 0.0, 0.0, 0.0 };
+    double step_time = 0.0;
+
+    for (int s = 0; s < steps; ++s)
+    {
+        auto start = std::chrono::steady_clock::now();
+        Integrator::Step(dt, balls, accel_fn, state);
+        step_time += Seconds(start);
+
+        double drift = fabs(TotalEnergy(forces, balls) - start_energy) / fabs(start_energy);
+        result.max_drift = std::max(result.max_drift, drift);
+        result.final_drift = drift;
+    }
+
+    result.ms_per_step = step_time * 1000.0 / steps;
+    return result;
+}
+
+// balls orbiting a single attractor, no walls and no drag so the exact answer keeps energy constant
+void BenchEnergy(const int num_bodies, const int steps, const float dt, const float tolerance)
+{
+    std::vector<Physics::ForceField> fields;
+    Physics::ForceField attractor;
+    Physics::ParseForceField("attractor 0 0 1000000 1", attractor);
+    fields.push_back(attractor);
+    Physics::ForceSet forces = Physics::BuildForceSet(fields);
+
+    std::mt19937 gen(1234);
+    std::uniform_real_distribution<float> orbit(50.0f, 400.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 2.0f * PI);
+    std::uniform_real_distribution<float> eccentric(0.8f, 1.1f);
+    std::vector<Raylib::Circle> balls;
+
+    for (int i = 0; i < num_bodies; ++i)
+    {
+        float r = orbit(gen);
+        float a = angle(gen);
+        float speed = sqrtf(attractor.strength / r) * eccentric(gen);
+
+        Raylib::Circle ball;
+        ball.CreateCircle(0, 0, 1.0f, WHITE);
+        ball.position = Vector2{ r * cosf(a), r * sinf(a) };
+        ball.velocity = Vector2{ -speed * sinf(a), speed * cosf(a) };
+        balls.push_back(ball);
+    }
+
+    EnergyResult results[4] = {
+        RunEnergy<Physics::ExplicitEuler>(forces, balls, steps, dt),
+        RunEnergy<Physics::SemiImplicitEuler>(forces, balls, steps, dt),
+        RunEnergy<Physics::VelocityVerlet>(forces, balls, steps, dt),
+        RunEnergy<Physics::RK4>(forces, balls, steps, dt)
+    };
+
+    std::cout << "energy: " << num_bodies << " bodies, " << steps << " steps of " << dt << " s" << std::endl;
+
+    const EnergyResult* cheapest = nullptr;
+    for (int i = 0; i < 4; ++i)
+    {
+        std::cout << "  " << results[i].name << ": " << results[i].ms_per_step << " ms/step, drift final "
+                  << results[i].final_drift << ", max " << results[i].max_drift << std::endl;
+
+        if (results[i].max_drift <= tolerance && (cheapest == nullptr || results[i].ms_per_step < cheapest->ms_per_step))
+        {
+            cheapest = &results[i];
+        }
+    }
+
+    if (cheapest != nullptr)
+    {
+        std::cout << "  cheapest within " << tolerance << " drift: " << cheapest->name << std::endl;
+    }
+    else
+    {
+        std::cout << "  nothing stays within " << tolerance << " drift, try a smaller dt" << std::endl;
+    }
+}
+
+// the hardware cache miss counter for this thread, -1 when the kernel won't hand one out (most VMs)
+int OpenCacheMissCounter()
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;           // the pool's threads too, as long as they're started after this
+
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+long ReadCounter(const int fd)
+{
+    long value = 0;
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value))
+    {
+        return -1;
+    }
+    return value;
+}
+
+typedef struct OrderResult
+{
+    double ms[Physics::PHASE_COUNT];
+    long cache_misses;          // -1 without a counter
+    double pair_gap;            // average index distance between the two balls of a pair, how far apart in memory they are
+    int sorts;
+
+} OrderResult;
+
+OrderResult RunOrder(std::vector<Raylib::Circle> balls, const float extent, const int steps, const bool reorder, const int counter)
+{
+    typedef Physics::SemiImplicitEuler Integrator;
+
+    Physics::Simulation<2> sim;
+    sim.balls.swap(balls);
+    sim.bounds_min = Vector2{ 0.0f, 0.0f };
+    sim.bounds_max = Vector2{ extent, extent };
+    sim.order.every = 0;
+    sim.order.disorder = reorder ? 1.0f : 0.0f;
+
+    OrderResult result = {};
+    const long misses_start = ReadCounter(counter);
+
+    for (int s = 0; s < steps; ++s)
+    {
+        Physics::StepSimulation<2, Physics::FEATURE_COLLISIONS, Integrator>(sim, 1.0f / 120.0f);
+
+        for (int p = 0; p < Physics::PHASE_COUNT; ++p)
+        {
+            result.ms[p] += sim.timings.ms[p] / steps;
+        }
+    }
+
+    result.cache_misses = counter >= 0 ? ReadCounter(counter) - misses_start : -1;
+    result.sorts = sim.order.sorts;
+
+    for (int p = 0; p < sim.pairs.size(); ++p)
+    {
+        result.pair_gap += (double)(sim.pairs[p].b - sim.pairs[p].a) / sim.pairs.size();
+    }
+    return result;
+}
+
+// the same crowded box stepped with the balls left in the order they were made and with them kept
+// in Z-order, to see what the cache locality is worth to the collision phases
+void BenchMorton(const int num_balls, const int steps)
+{
+    const float extent = sqrtf(num_balls * 80.0f);       // about a quarter of the box covered
+
+    std::vector<Raylib::Circle> balls;
+    CreateBodies(balls, num_balls, extent);
+
+    std::mt19937 gen(4321);
+    std::uniform_real_distribution<float> speed(-100.0f, 100.0f);
+    for (int i = 0; i < balls.size(); ++i)
+    {
+        balls[i].velocity = Vector2{ speed(gen), speed(gen) };
+    }
+
+    // the pool threads have to start after the counter for it to see them
+    const int counter = OpenCacheMissCounter();
+    Parallel::SetThreadCount(1);
+    Parallel::SetThreadCount(0);
+    if (counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    const OrderResult results[2] = { RunOrder(balls, extent, steps, false, counter), RunOrder(balls, extent, steps, true, counter) };
+    const char* names[2] = { "spawn order", "z-order" };
+
+    std::cout << "morton: " << num_balls << " balls, " << steps << " steps, " << Parallel::ThreadCount() << " threads" << std::endl;
+    for (int r = 0; r < 2; ++r)
+    {
+        double total = 0.0;
+        for (int p = 0; p < Physics::PHASE_COUNT; ++p)
+        {
+            total += results[r].ms[p];
+        }
+
+        std::cout << "  " << names[r] << ": " << total << " ms/step (";
+        for (int p = 0; p < Physics::PHASE_COUNT; ++p)
+        {
+            std::cout << (p > 0 ? ", " : "") << Physics::phase_names[p] << " " << results[r].ms[p];
+        }
+        std::cout << ")" << std::endl;
+
+        std::cout << "    pair index gap " << results[r].pair_gap << ", " << results[r].sorts << " sorts, cache misses ";
+        if (results[r].cache_misses >= 0)
+        {
+            std::cout << results[r].cache_misses << std::endl;
+        }
+        else
+        {
+            std::cout << "n/a (no hardware counters here)" << std::endl;
+        }
+    }
+}
+
+// radix sort against std::sort on the same (key, index) pairs, bits is how much of the key is random
+template <typename Key>
+void BenchSortKeys(const int count, const int bits)
+{
+    std::mt19937_64 gen(1234);
+    const Key mask = bits >= 8 * sizeof(Key) ? ~(Key)0 : ((Key)1 << bits) - 1;
+
+    std::vector<Key> keys(count);
+    std::vector<int> values(count);
+    std::vector<std::pair<Key, int>> pairs(count);
+    for (int i = 0; i < count; ++i)
+    {
+        keys[i] = (Key)gen() & mask;
+        values[i] = i;
+        pairs[i] = std::make_pair(keys[i], i);
+    }
+    const std::vector<Key> original = keys;
+
+    // once to size the scratch, then the run that's timed
+    Parallel::RadixScratch<Key> scratch;
+    std::vector<Key> warm_keys = keys;
+    std::vector<int> warm_values = values;
+    Parallel::RadixSort(warm_keys, warm_values, scratch);
+
+    auto start = std::chrono::steady_clock::now();
+    Parallel::RadixSort(keys, values, scratch);
+    const double radix_time = Seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    std::sort(pairs.begin(), pairs.end(), [](const std::pair<Key, int>& a, const std::pair<Key, int>& b) { return a.first < b.first; });
+    const double std_time = Seconds(start);
+
+    // same keys in the same order, and every value still points at its own key
+    int wrong = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        wrong += keys[i] != pairs[i].first || original[values[i]] != keys[i] || (i > 0 && keys[i] == keys[i - 1] && values[i] < values[i - 1]);
+    }
+
+    std::cout << "  " << 8 * sizeof(Key) << " bit keys, " << bits << " random bits: radix " << radix_time * 1000.0 << " ms ("
+              << count / radix_time / 1e6 << " M/s), std::sort " << std_time * 1000.0 << " ms (" << count / std_time / 1e6 << " M/s), "
+              << std_time / radix_time << "x" << (wrong > 0 ? ", WRONG" : "") << std::endl;
+}
+
+void BenchSort(const int count)
+{
+    std::cout << "sort: " << count << " pairs, " << Parallel::ThreadCount() << " threads" << std::endl;
+
+    BenchSortKeys<uint32_t>(count, 32);
+    BenchSortKeys<uint32_t>(count, 20);         // about what grid cell keys look like
+    BenchSortKeys<uint64_t>(count, 64);         // past 48 bits it's std::sort underneath
+    BenchSortKeys<uint64_t>(count, 56);
+    BenchSortKeys<uint64_t>(count, 48);         // the most the radix passes still get
+    BenchSortKeys<uint64_t>(count, 42);         // 21 bits a side of 2D Morton
+}
+
+// the pair and contact finding on 1, 2, 4 ... threads, each thread count has to come up with the
+// exact same pairs as one thread did
+void BenchPairs(const int num_balls, const int max_threads)
+{
+    const float extent = sqrtf(num_balls * 80.0f);
+
+    Physics::Simulation<2> sim;
+    CreateBodies(sim.balls, num_balls, extent);
+    sim.bounds_min = Vector2{ 0.0f, 0.0f };
+    sim.bounds_max = Vector2{ extent, extent };
+    Physics::ReorderBalls(sim);
+    Physics::UpdateGrid(sim.grid, sim.balls, sim.bounds_min, sim.bounds_max);
+
+    std::cout << "pairs: " << num_balls << " balls" << std::endl;
+
+    std::vector<Physics::CollisionPair> reference;
+    double one_thread = 0.0;
+    for (int threads = 1; threads <= max_threads; threads *= 2)
+    {
+        Parallel::SetThreadCount(threads);
+
+        // the first run sizes the per chunk lists
+        const int runs = 5;
+        double pair_time = 0.0, contact_time = 0.0;
+        for (int r = 0; r <= runs; ++r)
+        {
+            auto start = std::chrono::steady_clock::now();
+            Physics::FindPairsGrid(sim.grid, sim.balls, sim.pairs, sim.pair_lists);
+            pair_time += r > 0 ? Seconds(start) / runs : 0.0;
+
+            start = std::chrono::steady_clock::now();
+            Physics::Narrowphase(sim.balls, sim.pairs, sim.contacts, sim.contact_lists);
+            contact_time += r > 0 ? Seconds(start) / runs : 0.0;
+        }
+
+        bool same = true;
+        if (threads == 1)
+        {
+            reference = sim.pairs;
+            one_thread = pair_time + contact_time;
+        }
+        else
+        {
+            same = reference.size() == sim.pairs.size();
+            for (int p = 0; same && p < reference.size(); ++p)
+            {
+                same = reference[p].a == sim.pairs[p].a && reference[p].b == sim.pairs[p].b;
+            }
+        }
+
+        std::cout << "  " << threads << " threads: broadphase " << pair_time * 1000.0 << " ms, narrowphase " << contact_time * 1000.0
+                  << " ms, " << sim.pairs.size() << " pairs, " << sim.contacts.size() << " contacts, speedup "
+                  << one_thread / (pair_time + contact_time) << (same ? "" : ", DIFFERENT PAIRS") << std::endl;
+    }
+}
+
+// a whole step (forces, the integrator, reordering, every collision phase) and the snapshot copy
+// the render thread would get, run until the scratch has grown to fit, then what every subsystem
+// allocates over the steady state steps after that. The counts go out as JSON, and any steady
+// state step that allocated at all makes it fail
+bool BenchMemory(const int num_balls, const int steps, const std::string& json_path, const bool nbody)
+{
+    const float extent = sqrtf(num_balls * 80.0f);
+    const float dt = 1.0f / 120.0f;
+    const int warmup = 120;
+
+    Physics::Simulation<2> sim;
+    CreateBodies(sim.balls, num_balls, extent);
+    sim.bounds_min = Vector2{ 0.0f, 0.0f };
+    sim.bounds_max = Vector2{ extent, extent };
+    sim.order.every = 30;           // so a sort lands in the steady state steps too
+
+    std::mt19937 gen(4321);
+    std::uniform_real_distribution<float> speed(-100.0f, 100.0f);
+    for (int i = 0; i < num_balls; ++i)
+    {
+        sim.balls[i].velocity = Vector2{ speed(gen), speed(gen) };
+    }
+
+    if (nbody)
+    {
+        sim.nbody.enabled = true;
+        sim.nbody.G = 1.0f;
+    }
+
+    const Physics::StepFunction<2> step = Physics::SelectStepFunction<2>(Physics::VelocityVerlet::name, Physics::FEATURE_COLLISIONS);
+    std::vector<Raylib::Circle> snapshot;
+
+    auto frame = [&]
+    {
+        step(sim, dt);
+
+        Memory::MemoryScope memory(Memory::MEM_SNAPSHOT);
+        snapshot = sim.balls;
+    };
+
+    Memory::MemoryCounts start, before, after;
+    Memory::ReadCounts(start);
+    for (int s = 0; s < warmup; ++s)
+    {
+        frame();
+    }
+
+    Memory::MemoryCounts warm, steady;
+    Memory::ReadCounts(before);
+    for (int t = 0; t < Memory::MEM_TAG_COUNT; ++t)
+    {
+        warm.allocations[t] = before.allocations[t] - start.allocations[t];
+        warm.bytes[t] = before.bytes[t] - start.bytes[t];
+    }
+
+    int allocating_steps = 0, first_allocating = -1;
+    auto clock_start = std::chrono::steady_clock::now();
+    for (int s = 0; s < steps; ++s)
+    {
+        Memory::ReadCounts(before);
+        frame();
+        Memory::ReadCounts(after);
+
+        bool allocated = false;
+        for (int t = 0; t < Memory::MEM_TAG_COUNT; ++t)
+        {
+            steady.allocations[t] += after.allocations[t] - before.allocations[t];
+            steady.bytes[t] += after.bytes[t] - before.bytes[t];
+            allocated |= after.allocations[t] != before.allocations[t];
+        }
+        allocating_steps += allocated ? 1 : 0;
+        first_allocating = (allocated && first_allocating < 0) ? s : first_allocating;
+    }
+    const double ms_per_step = Seconds(clock_start) * 1000.0 / std::max(1, steps);
+
+    std::ofstream file;
+    if (json_path != "-")
+    {
+        file.open(json_path);
+    }
+    std::ostream& out = json_path != "-" ? file : std::cout;
+
+    out << "{\n";
+    out << "  \"balls\": " << num_balls << ",\n";
+    out << "  \"threads\": " << Parallel::ThreadCount() << ",\n";
+    out << "  \"nbody\": " << (nbody ? "true" : "false") << ",\n";
+    out << "  \"warmup_steps\": " << warmup << ",\n";
+    out << "  \"steps\": " << steps << ",\n";
+    out << "  \"ms_per_step\": " << ms_per_step << ",\n";
+    out << "  \"allocating_steps\": " << allocating_steps << ",\n";
+    out << "  \"first_allocating_step\": " << first_allocating << ",\n";
+    out << "  \"rss_kb\": " << Memory::ResidentKB() << ",\n";
+    out << "  \"peak_rss_kb\": " << Memory::PeakResidentKB() << ",\n";
+    out << "  \"task_arena_peak\": " << Parallel::TaskArenaPeak() << ",\n";
+    out << "  \"task_arena_size\": " << Parallel::Worker::arena_size << ",\n";
+    out << "  \"subsystems\": {\n";
+    for (int t = 0; t < Memory::MEM_TAG_COUNT; ++t)
+    {
+        out << "    \"" << Memory::tag_names[t] << "\": { \"warmup_allocations\": " << warm.allocations[t] << ", \"warmup_bytes\": " << warm.bytes[t]
+            << ", \"steady_allocations\": " << steady.allocations[t] << ", \"steady_bytes\": " << steady.bytes[t]
+            << ", \"high_water_bytes\": " << Memory::PeakLiveBytes(t) << " }" << (t + 1 < Memory::MEM_TAG_COUNT ? "," : "") << "\n";
+    }
+    out << "  },\n";
+    out << "  \"passed\": " << (allocating_steps == 0 ? "true" : "false") << "\n";
+    out << "}" << std::endl;
+
+    if (json_path != "-")
+    {
+        std::cout << "memory: " << num_balls << " balls, " << allocating_steps << " of " << steps << " steady state steps allocated, wrote " << json_path << std::endl;
+    }
+
+    for (int t = 0; t < Memory::MEM_TAG_COUNT; ++t)
+    {
+        if (steady.allocations[t] > 0)
+        {
+            std::cerr << "memory: " << Memory::tag_names[t] << " allocated " << steady.allocations[t] << " times (" << steady.bytes[t]
+                      << " bytes) in the steady state, the first time on step " << first_allocating << std::endl;
+        }
+    }
+    return allocating_steps == 0;
+}
+
+// queued ellipses have to come out of a flush, grouped by mesh and colour and where they were
+// queued, and the flush has to leave the queue empty and the meshes free to evict again. The
+// meshes stay on the CPU so this runs without a window, the draw is whatever the flush hands over
+bool BenchMeshQueue()
+{
+    Graphics::MeshCache& cache = Graphics::mesh_cache;
+    cache.upload = false;
+
+    Raylib::Ellipse red, other_red, blue;
+    red.CreateEllipse(100, 50, 10.0f, 6.0f, RED);
+    other_red.CreateEllipse(20, 30, 10.0f, 6.0f, RED);
+    blue.CreateEllipse(100, 50, 10.0f, 6.0f, BLUE);
+
+    red.QueueFilledEllipse();
+    other_red.QueueFilledEllipse();
+    blue.QueueFilledEllipse();
+
+    int failures = 0;
+    auto check = [&](bool ok, const char* what)
+    {
+        std::cout << "  " << (ok ? "ok     " : "FAILED ") << what << std::endl;
+        failures += ok ? 0 : 1;
+    };
+
+    const Graphics::MeshHandle handle = red.FindEllipseMesh();
+    check(cache.queued.size() == 3 && cache.slots[handle].queued == 3, "three ellipses queued on one mesh");
+
+    // queued meshes are pinned, not even a budget of nothing gets rid of them
+    Graphics::SetMeshCacheBudget(cache, 0);
+    check(cache.slots[handle].loaded, "a queued mesh survives eviction");
+
+    int draws = 0, red_copies = 0, blue_copies = 0;
+    bool red_in_place = false;
+    Graphics::FlushQueuedMeshes(cache, [&](Graphics::MeshHandle drawn, const Color& color, const Matrix* transforms, int count)
+    {
+        ++draws;
+        if (drawn != handle)
+        {
+            return;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            red_in_place |= ColorIsEqual(color, RED) && transforms[i].m12 == 100.0f && transforms[i].m13 == 50.0f;
+        }
+        red_copies += ColorIsEqual(color, RED) ? count : 0;
+        blue_copies += ColorIsEqual(color, BLUE) ? count : 0;
+    });
+
+    check(draws == 2 && red_copies == 2 && blue_copies == 1, "one draw per colour with every copy in it");
+    check(red_in_place, "the ellipse is drawn where it was queued");
+    check(cache.queued.empty() && cache.slots[handle].queued == 0, "the flush empties the queue");
+
+    Graphics::SetMeshCacheBudget(cache, 0);
+    check(!cache.slots[handle].loaded && cache.bytes_used == 0, "once drawn it can be evicted");
+
+    Graphics::UnloadMeshCache(cache);
+    cache.upload = true;
+
+    std::cout << "meshqueue: " << (failures == 0 ? "passed" : "FAILED") << std::endl;
+    return failures == 0;
+}
+
+int main(int argc, char** argv)
+{
+    std::string which = (argc > 1) ? argv[1] : "nbody";
+
+    Parallel::SetThreadCount(0);
+
+    if (which == "nbody")
+    {
+        int bodies = (argc > 2) ? atoi(argv[2]) : 100000;
+        float theta = (argc > 3) ? atof(argv[3]) : 0.5f;
+        BenchNBody(bodies, theta);
+    }
+    else if (which == "energy")
+    {
+        int bodies = (argc > 2) ? atoi(argv[2]) : 1000;
+        int steps = (argc > 3) ? atoi(argv[3]) : 5000;
+        float dt = (argc > 4) ? atof(argv[4]) : 1.0f / 120.0f;
+        float tolerance = (argc > 5) ? atof(argv[5]) : 0.01f;
+        BenchEnergy(bodies, steps, dt, tolerance);
+    }
+    else if (which == "morton")
+    {
+        int balls = (argc > 2) ? atoi(argv[2]) : 200000;
+        int steps = (argc > 3) ? atoi(argv[3]) : 200;
+        BenchMorton(balls, steps);
+    }
+    else if (which == "sort")
+    {
+        int count = (argc > 2) ? atoi(argv[2]) : 4000000;
+        BenchSort(count);
+    }
+    else if (which == "pairs")
+    {
+        int balls = (argc > 2) ? atoi(argv[2]) : 500000;
+        int threads = (argc > 3) ? atoi(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+        BenchPairs(balls, threads);
+    }
+    else if (which == "memory")
+    {
+        int balls = (argc > 2) ? atoi(argv[2]) : 20000;
+        int steps = (argc > 3) ? atoi(argv[3]) : 600;
+        std::string json = (argc > 4) ? argv[4] : "-";
+        bool nbody = (argc > 5) && std::string(argv[5]) == "nbody";
+        return BenchMemory(balls, steps, json, nbody) ? 0 : 1;
+    }
+    else if (which == "meshqueue")
+    {
+        return BenchMeshQueue() ? 0 : 1;
+    }
+    else
+    {
+        std::cout << "usage: ./bench nbody [bodies] [theta]" << std::endl;
+        std::cout << "       ./bench energy [bodies] [steps] [dt] [tolerance]" << std::endl;
+        std::cout << "       ./bench morton [balls] [steps]" << std::endl;
+        std::cout << "       ./bench sort [count]" << std::endl;
+        std::cout << "       ./bench pairs [balls] [max threads]" << std::endl;
+        std::cout << "       ./bench memory [balls] [steps] [json file, - for stdout] [nbody]" << std::endl;
+        std::cout << "       ./bench meshqueue" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef CANVAS_H
+#define CANVAS_H
+
+#include <raylib.h>
+#include "meshcache.h"
+
+#include <string>
+#include <vector>
+
+// the 2D scene gets drawn onto a "canvas", which is anything with these free functions:
+//   CanvasClear(canvas, color)
+//   CanvasCircle(canvas, center, radius, color)
+//   CanvasCircleLines(canvas, center, radius, color)
+//   CanvasLine(canvas, start, end, color)
+//   CanvasRectangle(canvas, x, y, width, height, color)
+//   CanvasRectangleLines(canvas, x, y, width, height, color)
+//   CanvasText(canvas, text, x, y, font_size, color)
+//   CanvasTextWidth(canvas, text, font_size)
+//   CanvasWidth(canvas), CanvasHeight(canvas)
+//   CanvasBeginWorld(canvas), CanvasEndWorld(canvas)  around everything that pans and zooms with the camera
+//   CanvasBalls(canvas, balls, outline)      (has a generic version below)
+// the shapes in defs.h have template versions of their Draw functions that call these, so the
+// same drawing code goes to the GPU (ScreenCanvas) or the software rasterizer (SoftCanvas in softraster.h)
+
+namespace Graphics
+{
+    struct CircleRenderer;
+    struct DensityMap;
+
+    // the window, everything goes straight to raylib. With a circle renderer (render2d.h) the balls
+    // go through its batch instead, with a density map (density.h) they're drawn as a heat map, and
+    // the camera is what the world is being drawn with
+    typedef struct ScreenCanvas
+    {
+        CircleRenderer* circles = NULL;
+        DensityMap* density = NULL;
+        Camera2D camera = { { 0.0f, 0.0f }, { 0.0f, 0.0f }, 0.0f, 1.0f };
+
+    } ScreenCanvas;
+
+    inline void CanvasClear(ScreenCanvas&, const Color& color) { ClearBackground(color); }
+    inline void CanvasCircle(ScreenCanvas&, const Vector2& center, float radius, const Color& color) { DrawCircle(center.x, center.y, radius, color); }
+    inline void CanvasCircleLines(ScreenCanvas&, const Vector2& center, float radius, const Color& color) { DrawCircleLines(center.x, center.y, radius, color); }
+    inline void CanvasLine(ScreenCanvas&, const Vector2& start, const Vector2& end, const Color& color) { DrawLine(start.x, start.y, end.x, end.y, color); }
+    inline void CanvasRectangle(ScreenCanvas&, int x, int y, int width, int height, const Color& color) { DrawRectangle(x, y, width, height, color); }
+    inline void CanvasRectangleLines(ScreenCanvas&, int x, int y, int width, int height, const Color& color) { DrawRectangleLines(x, y, width, height, color); }
+    inline void CanvasText(ScreenCanvas&, const std::string& text, int x, int y, int font_size, const Color& color) { DrawText(text.c_str(), x, y, font_size, color); }
+    inline int CanvasTextWidth(ScreenCanvas&, const std::string& text, int font_size) { return MeasureText(text.c_str(), font_size); }
+    inline int CanvasWidth(ScreenCanvas&) { return GetScreenWidth(); }
+    inline int CanvasHeight(ScreenCanvas&) { return GetScreenHeight(); }
+    inline void CanvasBeginWorld(ScreenCanvas& canvas) { BeginMode2D(canvas.camera); }
+    inline void CanvasEndWorld(ScreenCanvas&) { DrawQueuedMeshes(mesh_cache); EndMode2D(); }      // queued shapes go out with the camera still on
+
+    // every ball filled then outlined, one at a time, canvases with something faster overload this
+    template <typename Canvas, typename Ball>
+    void CanvasBalls(Canvas& canvas, const std::vector<Ball>& balls, const Color& outline)
+    {
+        for (int i = 0; i < balls.size(); ++i)
+        {
+            CanvasCircle(canvas, balls[i].position, balls[i].radius, balls[i].color);
+            CanvasCircleLines(canvas, balls[i].position, balls[i].radius, outline);
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,477 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "softraster.h"
+
+#include <raylib.h>
+#include <rlgl.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <filesystem>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+// records runs to disk. Frames come from a RenderTexture2D read back through pixel buffer objects
+// (the copy happens on the GPU and is only mapped a couple of frames later, so the main loop never
+// stalls on it), or straight from a SoftCanvas when headless. A background thread encodes them:
+//   out.y4m    -> one YUV4MPEG2 file (4:2:0), ffmpeg and most players read it directly
+//   out.raw    -> RGBA8 frames back to back
+//   anything else is a directory that gets frame_00000.png, frame_00001.png, ...
+// the queue to the encoder is bounded, if it's full the frame is dropped instead of waiting (headless
+// runs have no frame rate to keep up, so they can ask to wait instead and keep every frame)
+
+// the buffer object calls raylib doesn't wrap, looked up through glfw (which raylib links in) so we don't
+// need a GL loader of our own
+extern "C" void* glfwGetProcAddress(const char* name);
+
+namespace Graphics
+{
+    enum CaptureFormat
+    {
+        CAPTURE_Y4M,
+        CAPTURE_RAW,
+        CAPTURE_PNG
+    };
+
+    typedef struct CaptureFrame
+    {
+        std::vector<unsigned char> rgba;
+        int index;
+        bool flipped;           // GL reads rows bottom up
+
+    } CaptureFrame;
+
+    typedef void (*GLBindBufferFn)(unsigned int target, unsigned int buffer);
+    typedef void (*GLBufferDataFn)(unsigned int target, long size, const void* data, unsigned int usage);
+    typedef void* (*GLMapBufferFn)(unsigned int target, unsigned int access);
+    typedef unsigned char (*GLUnmapBufferFn)(unsigned int target);
+    typedef void (*GLGenBuffersFn)(int n, unsigned int* buffers);
+    typedef void (*GLDeleteBuffersFn)(int n, const unsigned int* buffers);
+    typedef void (*GLReadPixelsFn)(int x, int y, int width, int height, unsigned int format, unsigned int type, void* pixels);
+
+    const unsigned int GL_PIXEL_PACK_BUFFER_ = 0x88EB;
+    const unsigned int GL_STREAM_READ_ = 0x88E1;
+    const unsigned int GL_READ_ONLY_ = 0x88B8;
+    const unsigned int GL_RGBA_ = 0x1908;
+    const unsigned int GL_UNSIGNED_BYTE_ = 0x1401;
+
+    const int capture_pbo_count = 3;        // frames in flight on the GPU before we map the oldest
+
+    typedef struct Capture
+    {
+        bool active = false;
+        CaptureFormat format = CAPTURE_PNG;
+        std::string path;
+        int width = 0;
+        int height = 0;
+        int fps = 60;
+        FILE* file = NULL;
+
+        // frames move free -> queued -> (encoder) -> free, the pool never grows after StartCapture()
+        std::vector<CaptureFrame> frames;
+        std::vector<int> free_frames;
+        std::deque<int> queued;
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::condition_variable freed;
+        bool wait_when_full = false;
+        bool closing = false;
+        std::thread encoder;
+
+        int captured = 0;       // frames handed to the encoder
+        int dropped = 0;        // frames thrown away because the encoder was behind
+        int written = 0;
+
+        // GPU readback
+        bool gpu = false;
+        RenderTexture2D target = { 0 };
+        unsigned int pbos[capture_pbo_count] = { 0 };
+        int pbo_pending[capture_pbo_count] = { 0 };     // 1 when a read into that PBO hasn't been mapped yet
+        int pbo_next = 0;
+
+        GLBindBufferFn glBindBuffer = NULL;
+        GLBufferDataFn glBufferData = NULL;
+        GLMapBufferFn glMapBuffer = NULL;
+        GLUnmapBufferFn glUnmapBuffer = NULL;
+        GLGenBuffersFn glGenBuffers = NULL;
+        GLDeleteBuffersFn glDeleteBuffers = NULL;
+        GLReadPixelsFn glReadPixels = NULL;
+
+    } Capture;
+
+    inline CaptureFormat CaptureFormatFromPath(const std::string& path)
+    {
+        const std::string ext = std::filesystem::path(path).extension().string();
+
+        if (ext == ".y4m")
+        {
+            return CAPTURE_Y4M;
+        }
+        if (ext == ".raw")
+        {
+            return CAPTURE_RAW;
+        }
+        return CAPTURE_PNG;
+    }
+
+    // BT.601 full range, what C420jpeg means in a y4m header
+    inline void WriteY4MFrame(FILE* file, const CaptureFrame& frame, int width, int height, std::vector<unsigned char>& planes)
+    {
+        const int cw = (width + 1) / 2;
+        const int ch = (height + 1) / 2;
+        planes.resize(width * height + 2 * cw * ch);
+
+        unsigned char* y_plane = planes.data();
+        unsigned char* u_plane = y_plane + width * height;
+        unsigned char* v_plane = u_plane + cw * ch;
+
+        auto pixel = [&](int x, int y) -> const unsigned char*
+        {
+            const int row = frame.flipped ? height - 1 - y : y;
+            return &frame.rgba[(row * width + x) * 4];
+        };
+
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const unsigned char* p = pixel(x, y);
+                y_plane[y * width + x] = (unsigned char)std::clamp(0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] + 0.5f, 0.0f, 255.0f);
+            }
+        }
+
+        // chroma from the average of each 2x2 block
+        for (int y = 0; y < ch; ++y)
+        {
+            for (int x = 0; x < cw; ++x)
+            {
+                float r = 0.0f, g = 0.0f, b = 0.0f;
+                int n = 0;
+                for (int dy = 0; dy < 2 && 2 * y + dy < height; ++dy)
+                {
+                    for (int dx = 0; dx < 2 && 2 * x + dx < width; ++dx)
+                    {
+                        const unsigned char* p = pixel(2 * x + dx, 2 * y + dy);
+                        r += p[0];
+                        g += p[1];
+                        b += p[2];
+                        ++n;
+                    }
+                }
+                r /= n;
+                g /= n;
+                b /= n;
+
+                u_plane[y * cw + x] = (unsigned char)std::clamp(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b + 0.5f, 0.0f, 255.0f);
+                v_plane[y * cw + x] = (unsigned char)std::clamp(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b + 0.5f, 0.0f, 255.0f);
+            }
+        }
+
+        fputs("FRAME\n", file);
+        fwrite(planes.data(), 1, planes.size(), file);
+    }
+
+    inline void EncodeFrame(Capture& capture, CaptureFrame& frame, std::vector<unsigned char>& scratch)
+    {
+        if (frame.flipped && capture.format != CAPTURE_Y4M)
+        {
+            // flip in place, row by row
+            const int stride = capture.width * 4;
+            scratch.resize(stride);
+            for (int y = 0; y < capture.height / 2; ++y)
+            {
+                unsigned char* a = &frame.rgba[y * stride];
+                unsigned char* b = &frame.rgba[(capture.height - 1 - y) * stride];
+                memcpy(scratch.data(), a, stride);
+                memcpy(a, b, stride);
+                memcpy(b, scratch.data(), stride);
+            }
+            frame.flipped = false;
+        }
+
+        switch (capture.format)
+        {
+            case CAPTURE_Y4M:
+                WriteY4MFrame(capture.file, frame, capture.width, capture.height, scratch);
+                break;
+
+            case CAPTURE_RAW:
+                fwrite(frame.rgba.data(), 1, frame.rgba.size(), capture.file);
+                break;
+
+            case CAPTURE_PNG:
+            {
+                char name[32];
+                snprintf(name, sizeof(name), "frame_%05d.png", frame.index);
+                const std::string file_path = (std::filesystem::path(capture.path) / name).string();
+                ExportImage(Image{ frame.rgba.data(), capture.width, capture.height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 }, file_path.c_str());
+                break;
+            }
+        }
+    }
+
+    inline void EncoderLoop(Capture& capture)
+    {
+        std::vector<unsigned char> scratch;
+
+        while (true)
+        {
+            int f;
+            {
+                std::unique_lock<std::mutex> lock(capture.mutex);
+                capture.ready.wait(lock, [&] { return !capture.queued.empty() || capture.closing; });
+
+                if (capture.queued.empty())
+                {
+                    return;
+                }
+                f = capture.queued.front();
+                capture.queued.pop_front();
+            }
+
+            EncodeFrame(capture, capture.frames[f], scratch);
+
+            {
+                std::lock_guard<std::mutex> lock(capture.mutex);
+                capture.free_frames.push_back(f);
+                ++capture.written;
+            }
+            capture.freed.notify_one();
+        }
+    }
+
+    // a free frame to fill, or -1 if the encoder has them all and this one has to be dropped
+    inline int AcquireCaptureFrame(Capture& capture)
+    {
+        std::unique_lock<std::mutex> lock(capture.mutex);
+
+        if (capture.wait_when_full)
+        {
+            capture.freed.wait(lock, [&] { return !capture.free_frames.empty(); });
+        }
+
+        if (capture.free_frames.empty())
+        {
+            ++capture.dropped;
+            return -1;
+        }
+
+        int f = capture.free_frames.back();
+        capture.free_frames.pop_back();
+        return f;
+    }
+
+    inline void QueueCaptureFrame(Capture& capture, int f, bool flipped)
+    {
+        {
+            std::lock_guard<std::mutex> lock(capture.mutex);
+            capture.frames[f].index = capture.captured++;
+            capture.frames[f].flipped = flipped;
+            capture.queued.push_back(f);
+        }
+        capture.ready.notify_one();
+    }
+
+    inline bool LoadCaptureGL(Capture& capture)
+    {
+        capture.glBindBuffer = (GLBindBufferFn)glfwGetProcAddress("glBindBuffer");
+        capture.glBufferData = (GLBufferDataFn)glfwGetProcAddress("glBufferData");
+        capture.glMapBuffer = (GLMapBufferFn)glfwGetProcAddress("glMapBuffer");
+        capture.glUnmapBuffer = (GLUnmapBufferFn)glfwGetProcAddress("glUnmapBuffer");
+        capture.glGenBuffers = (GLGenBuffersFn)glfwGetProcAddress("glGenBuffers");
+        capture.glDeleteBuffers = (GLDeleteBuffersFn)glfwGetProcAddress("glDeleteBuffers");
+        capture.glReadPixels = (GLReadPixelsFn)glfwGetProcAddress("glReadPixels");
+
+        return capture.glBindBuffer && capture.glBufferData && capture.glMapBuffer && capture.glUnmapBuffer &&
+               capture.glGenBuffers && capture.glDeleteBuffers && capture.glReadPixels;
+    }
+
+    // gpu means frames come from the render texture (needs a window), otherwise from CaptureSoftCanvas().
+    // queue_length is how many frames can wait for the encoder before new ones get dropped (or waited for)
+    inline bool StartCapture(Capture& capture, const std::string& path, int width, int height, int fps, bool gpu, bool wait_when_full = false, int queue_length = 8)
+    {
+        capture.format = CaptureFormatFromPath(path);
+        capture.path = path;
+        capture.width = width;
+        capture.height = height;
+        capture.fps = fps;
+        capture.gpu = gpu;
+        capture.wait_when_full = wait_when_full;
+
+        if (capture.format == CAPTURE_PNG)
+        {
+            std::error_code error;
+            std::filesystem::create_directories(path, error);
+        }
+        else
+        {
+            capture.file = fopen(path.c_str(), "wb");
+            if (capture.file == NULL)
+            {
+                std::cout << "capture: couldn't open " << path << std::endl;
+                return false;
+            }
+
+            if (capture.format == CAPTURE_Y4M)
+            {
+                fprintf(capture.file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+            }
+        }
+
+        if (gpu)
+        {
+            if (!LoadCaptureGL(capture))
+            {
+                std::cout << "capture: pixel buffer objects aren't available" << std::endl;
+                if (capture.file)
+                {
+                    fclose(capture.file);
+                    capture.file = NULL;
+                }
+                return false;
+            }
+
+            capture.target = LoadRenderTexture(width, height);
+            capture.glGenBuffers(capture_pbo_count, capture.pbos);
+            for (int i = 0; i < capture_pbo_count; ++i)
+            {
+                capture.glBindBuffer(GL_PIXEL_PACK_BUFFER_, capture.pbos[i]);
+                capture.glBufferData(GL_PIXEL_PACK_BUFFER_, (long)width * height * 4, NULL, GL_STREAM_READ_);
+                capture.pbo_pending[i] = 0;
+            }
+            capture.glBindBuffer(GL_PIXEL_PACK_BUFFER_, 0);
+            capture.pbo_next = 0;
+        }
+
+        capture.frames.resize(queue_length);
+        capture.free_frames.clear();
+        for (int f = 0; f < queue_length; ++f)
+        {
+            capture.frames[f].rgba.resize(width * height * 4);
+            capture.free_frames.push_back(f);
+        }
+
+        capture.queued.clear();
+        capture.closing = false;
+        capture.captured = capture.dropped = capture.written = 0;
+        capture.encoder = std::thread(EncoderLoop, std::ref(capture));
+        capture.active = true;
+        return true;
+    }
+
+    // headless frames are already in memory, just copy them over
+    inline void CaptureSoftCanvas(Capture& capture, const SoftCanvas& canvas)
+    {
+        if (!capture.active || canvas.width != capture.width || canvas.height != capture.height)
+        {
+            return;
+        }
+
+        const int f = AcquireCaptureFrame(capture);
+        if (f >= 0)
+        {
+            memcpy(capture.frames[f].rgba.data(), canvas.pixels.data(), canvas.pixels.size() * sizeof(Color));
+            QueueCaptureFrame(capture, f, false);
+        }
+    }
+
+    // copies the PBO filled capture_pbo_count - 1 frames ago into a free frame
+    inline void MapCapturePBO(Capture& capture, int p)
+    {
+        capture.glBindBuffer(GL_PIXEL_PACK_BUFFER_, capture.pbos[p]);
+
+        const int f = AcquireCaptureFrame(capture);
+        if (f >= 0)
+        {
+            const void* data = capture.glMapBuffer(GL_PIXEL_PACK_BUFFER_, GL_READ_ONLY_);
+            if (data != NULL)
+            {
+                memcpy(capture.frames[f].rgba.data(), data, capture.frames[f].rgba.size());
+                capture.glUnmapBuffer(GL_PIXEL_PACK_BUFFER_);
+                QueueCaptureFrame(capture, f, true);
+            }
+            else
+            {
+                std::lock_guard<std::mutex> lock(capture.mutex);
+                capture.free_frames.push_back(f);
+            }
+        }
+
+        capture.pbo_pending[p] = 0;
+    }
+
+    // draw the frame between BeginTextureMode(capture.target) and EndTextureMode(), then call this.
+    // It starts an asynchronous read of the render texture and collects the oldest one still in flight
+    inline void ReadbackCapture(Capture& capture)
+    {
+        if (!capture.active || !capture.gpu)
+        {
+            return;
+        }
+
+        const int p = capture.pbo_next;
+        if (capture.pbo_pending[p])
+        {
+            MapCapturePBO(capture, p);
+        }
+
+        rlDrawRenderBatchActive();
+        rlEnableFramebuffer(capture.target.id);
+        capture.glBindBuffer(GL_PIXEL_PACK_BUFFER_, capture.pbos[p]);
+        capture.glReadPixels(0, 0, capture.width, capture.height, GL_RGBA_, GL_UNSIGNED_BYTE_, NULL);
+        capture.glBindBuffer(GL_PIXEL_PACK_BUFFER_, 0);
+        rlDisableFramebuffer();
+
+        capture.pbo_pending[p] = 1;
+        capture.pbo_next = (p + 1) % capture_pbo_count;
+    }
+
+    // collects whatever's still on the GPU, lets the encoder finish the queue and closes the output
+    inline void StopCapture(Capture& capture)
+    {
+        if (!capture.active)
+        {
+            return;
+        }
+
+        if (capture.gpu)
+        {
+            for (int k = 0; k < capture_pbo_count; ++k)
+            {
+                const int p = (capture.pbo_next + k) % capture_pbo_count;
+                if (capture.pbo_pending[p])
+                {
+                    MapCapturePBO(capture, p);
+                }
+            }
+            capture.glBindBuffer(GL_PIXEL_PACK_BUFFER_, 0);
+            capture.glDeleteBuffers(capture_pbo_count, capture.pbos);
+            UnloadRenderTexture(capture.target);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(capture.mutex);
+            capture.closing = true;
+        }
+        capture.ready.notify_one();
+        capture.encoder.join();
+
+        if (capture.file)
+        {
+            fclose(capture.file);
+            capture.file = NULL;
+        }
+
+        std::cout << "capture: wrote " << capture.written << " frames to " << capture.path << ", dropped " << capture.dropped << std::endl;
+        capture.active = false;
+    }
+};
+
+#endif
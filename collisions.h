@@ -0,0 +1,530 @@
+#ifndef COLLISIONS_H
+#define COLLISIONS_H
+
+#include "defs.h"
+#include "dimension.h"
+#include "sort.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// ball vs ball collisions in three stages:
+//   broadphase   - cheaply find pairs whose bounding boxes overlap (uniform grid, or everything vs everything)
+//   narrowphase  - turn overlapping pairs into contacts with a normal and a depth
+//   solve        - push the balls apart and bounce them off each other
+
+namespace Physics
+{
+    enum BroadphaseType
+    {
+        BROADPHASE_GRID,        // uniform grid, only balls that changed cell get moved every step
+        BROADPHASE_BRUTE,       // O(n^2), handy as a reference
+        BROADPHASE_SORTED       // cell keys radix sorted every step, nothing kept but every cell's balls sit together
+    };
+
+    typedef struct CollisionPair
+    {
+        int a, b;               // a < b
+
+    } CollisionPair;
+
+    template <typename Vec>
+    struct Contact
+    {
+        int a, b;
+        Vec normal;             // from a to b
+        float depth;
+    };
+
+    // one list per chunk of work so threads finding pairs or contacts never push to the same vector,
+    // see Parallel::Collect()
+    template <typename T>
+    using ChunkLists = std::vector<std::vector<T>>;
+
+    // cells are at least one ball wide, so a ball can only ever touch balls in the 3^D cells around it.
+    // Every cell is a doubly linked list of ball indices, so the grid is kept from step to step and
+    // a ball changing cell, appearing or being swap removed (pool.h) is a couple of pointer fixes
+    // instead of binning everything again
+    template <int D>
+    struct UniformGrid
+    {
+        typedef typename Dimension<D>::Vec Vec;
+
+        Vec origin;
+        Vec extent;                     // the box it was built for
+        float cell_size = 1.0f;
+        int dims[3] = { 1, 1, 1 };
+        std::vector<int> cell_head;     // first ball in each cell, -1 when empty
+        std::vector<int> next, prev;    // per ball, the rest of its cell, -1 at the ends
+        std::vector<int> cell_of;       // which cell each ball is in
+
+        int rebuilds = 0;               // whole grid built again
+        int moved = 0;                  // balls that changed cell in the last update
+    };
+
+    template <int D>
+    inline int GridCoord(const UniformGrid<D>& grid, const typename Dimension<D>::Vec& pos, int axis)
+    {
+        int c = (int)((Component(pos, axis) - Component(grid.origin, axis)) / grid.cell_size);
+        return std::clamp(c, 0, grid.dims[axis] - 1);
+    }
+
+    template <int D>
+    inline int GridCell(const UniformGrid<D>& grid, const typename Dimension<D>::Vec& pos)
+    {
+        int cell = 0;
+        for (int axis = D - 1; axis >= 0; --axis)
+        {
+            cell = cell * grid.dims[axis] + GridCoord(grid, pos, axis);
+        }
+        return cell;
+    }
+
+    // the cell size for the biggest ball, doubled until the cell count is in proportion to the
+    // ball count so a big empty box doesn't eat memory
+    template <int D>
+    float GridCellSize(const typename Dimension<D>::Vec& lo, const typename Dimension<D>::Vec& hi, const float max_radius, const int n)
+    {
+        const long max_cells = 4L * n + 64;
+        float cell_size = 2.0f * max_radius;
+
+        while (true)
+        {
+            long cells = 1;
+            for (int axis = 0; axis < D; ++axis)
+            {
+                cells *= std::max(1, (int)ceilf((Component(hi, axis) - Component(lo, axis)) / cell_size));
+            }
+
+            if (cells <= max_cells)
+            {
+                return cell_size;
+            }
+            cell_size *= 2.0f;
+        }
+    }
+
+    template <int D>
+    inline void GridLink(UniformGrid<D>& grid, const int i, const int cell)
+    {
+        grid.cell_of[i] = cell;
+        grid.prev[i] = -1;
+        grid.next[i] = grid.cell_head[cell];
+        if (grid.next[i] != -1)
+        {
+            grid.prev[grid.next[i]] = i;
+        }
+        grid.cell_head[cell] = i;
+    }
+
+    template <int D>
+    inline void GridUnlink(UniformGrid<D>& grid, const int i)
+    {
+        if (grid.prev[i] != -1)
+        {
+            grid.next[grid.prev[i]] = grid.next[i];
+        }
+        else
+        {
+            grid.cell_head[grid.cell_of[i]] = grid.next[i];
+        }
+
+        if (grid.next[i] != -1)
+        {
+            grid.prev[grid.next[i]] = grid.prev[i];
+        }
+    }
+
+    // bins every ball inside [lo, hi] into the grid from scratch, anything outside gets clamped to the edge cells
+    template <int D>
+    void BuildGrid(UniformGrid<D>& grid, const std::vector<typename Dimension<D>::Body>& balls, const typename Dimension<D>::Vec& lo,
+                   const typename Dimension<D>::Vec& hi, const float cell_size)
+    {
+        const int n = balls.size();
+
+        grid.origin = lo;
+        grid.extent = hi;
+        grid.cell_size = cell_size;
+
+        int cells = 1;
+        for (int axis = 0; axis < D; ++axis)
+        {
+            grid.dims[axis] = std::max(1, (int)ceilf((Component(hi, axis) - Component(lo, axis)) / grid.cell_size));
+            cells *= grid.dims[axis];
+        }
+
+        grid.cell_head.assign(cells, -1);
+        grid.next.resize(n);
+        grid.prev.resize(n);
+        grid.cell_of.resize(n);
+
+        // backwards so every cell lists its balls in index order
+        for (int i = n - 1; i >= 0; --i)
+        {
+            GridLink(grid, i, GridCell(grid, Position(balls[i])));
+        }
+
+        ++grid.rebuilds;
+        grid.moved = n;
+    }
+
+    template <int D>
+    void BuildGrid(UniformGrid<D>& grid, const std::vector<typename Dimension<D>::Body>& balls, const typename Dimension<D>::Vec& lo, const typename Dimension<D>::Vec& hi)
+    {
+        float max_radius = 0.5f;
+        for (int i = 0; i < balls.size(); ++i)
+        {
+            max_radius = std::max(max_radius, balls[i].radius);
+        }
+
+        BuildGrid(grid, balls, lo, hi, GridCellSize<D>(lo, hi, max_radius, balls.size()));
+    }
+
+    // brings the grid up to date after the balls moved, only the ones that crossed into another cell
+    // get relinked. It's built again when the box changed, when it's out of step with the balls, or
+    // when the ball radii or count call for a different cell size
+    template <int D>
+    void UpdateGrid(UniformGrid<D>& grid, const std::vector<typename Dimension<D>::Body>& balls, const typename Dimension<D>::Vec& lo, const typename Dimension<D>::Vec& hi)
+    {
+        const int n = balls.size();
+
+        float max_radius = 0.5f;
+        for (int i = 0; i < n; ++i)
+        {
+            max_radius = std::max(max_radius, balls[i].radius);
+        }
+
+        const float cell_size = GridCellSize<D>(lo, hi, max_radius, n);
+
+        bool same_box = true;
+        for (int axis = 0; axis < D; ++axis)
+        {
+            same_box &= Component(grid.origin, axis) == Component(lo, axis) && Component(grid.extent, axis) == Component(hi, axis);
+        }
+
+        if (!same_box || cell_size != grid.cell_size || grid.cell_of.size() != n || grid.cell_head.empty())
+        {
+            BuildGrid(grid, balls, lo, hi, cell_size);
+            return;
+        }
+
+        grid.moved = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            const int cell = GridCell(grid, Position(balls[i]));
+            if (cell != grid.cell_of[i])
+            {
+                GridUnlink(grid, i);
+                GridLink(grid, i, cell);
+                ++grid.moved;
+            }
+        }
+    }
+
+    // a ball was just added at the end of the array
+    template <int D>
+    void GridAdd(UniformGrid<D>& grid, const std::vector<typename Dimension<D>::Body>& balls)
+    {
+        const int i = balls.size() - 1;
+        if (grid.cell_head.empty() || grid.cell_of.size() != i)
+        {
+            return;             // not built yet or already out of step, the next update builds it
+        }
+
+        grid.next.push_back(-1);
+        grid.prev.push_back(-1);
+        grid.cell_of.push_back(0);
+        GridLink(grid, i, GridCell(grid, Position(balls[i])));
+    }
+
+    // ball i is going and the last ball is about to be moved into its slot, call before the balls change
+    template <int D>
+    void GridSwapRemove(UniformGrid<D>& grid, const int i)
+    {
+        const int last = grid.cell_of.size() - 1;
+        if (grid.cell_head.empty() || i > last)
+        {
+            return;
+        }
+
+        GridUnlink(grid, i);
+
+        // the last ball keeps its place in its cell's list but answers to index i now
+        if (i != last)
+        {
+            grid.cell_of[i] = grid.cell_of[last];
+            grid.next[i] = grid.next[last];
+            grid.prev[i] = grid.prev[last];
+
+            if (grid.prev[i] != -1)
+            {
+                grid.next[grid.prev[i]] = i;
+            }
+            else
+            {
+                grid.cell_head[grid.cell_of[i]] = i;
+            }
+
+            if (grid.next[i] != -1)
+            {
+                grid.prev[grid.next[i]] = i;
+            }
+        }
+
+        grid.next.pop_back();
+        grid.prev.pop_back();
+        grid.cell_of.pop_back();
+    }
+
+    // the same cells as UniformGrid, binned from scratch every step by sorting (cell, ball) pairs
+    // on the cell, so a cell's balls are one run of order instead of a list to chase
+    template <int D>
+    struct SortedGrid
+    {
+        typedef typename Dimension<D>::Vec Vec;
+
+        UniformGrid<D> cells;           // only the shape, its lists stay empty
+        std::vector<uint32_t> keys;     // cell of each entry of order
+        std::vector<int> order;         // ball indices sorted by cell
+        std::vector<int> cell_start;    // where each cell's run starts in order, one past the end for the last
+        Parallel::RadixScratch<uint32_t> scratch;
+    };
+
+    template <int D>
+    void BuildSortedGrid(SortedGrid<D>& grid, const std::vector<typename Dimension<D>::Body>& balls, const typename Dimension<D>::Vec& lo,
+                         const typename Dimension<D>::Vec& hi)
+    {
+        const int n = balls.size();
+        UniformGrid<D>& cells = grid.cells;
+
+        float max_radius = 0.5f;
+        for (int i = 0; i < n; ++i)
+        {
+            max_radius = std::max(max_radius, balls[i].radius);
+        }
+
+        cells.origin = lo;
+        cells.extent = hi;
+        cells.cell_size = GridCellSize<D>(lo, hi, max_radius, n);
+
+        int num_cells = 1;
+        for (int axis = 0; axis < D; ++axis)
+        {
+            cells.dims[axis] = std::max(1, (int)ceilf((Component(hi, axis) - Component(lo, axis)) / cells.cell_size));
+            num_cells *= cells.dims[axis];
+        }
+
+        grid.keys.resize(n);
+        grid.order.resize(n);
+        Parallel::For(0, n, [&](int start, int stop, int)
+        {
+            for (int i = start; i < stop; ++i)
+            {
+                grid.keys[i] = GridCell(cells, Position(balls[i]));
+                grid.order[i] = i;
+            }
+        });
+
+        Parallel::RadixSort(grid.keys, grid.order, grid.scratch);
+
+        // every cell starts where the first key at or past it is
+        grid.cell_start.resize(num_cells + 1);
+        int k = 0;
+        for (int cell = 0; cell <= num_cells; ++cell)
+        {
+            while (k < n && grid.keys[k] < cell)
+            {
+                ++k;
+            }
+            grid.cell_start[cell] = k;
+        }
+    }
+
+    template <typename Body>
+    inline bool BoundsOverlap(const Body& a, const Body& b)
+    {
+        const auto d = Position(b) - Position(a);
+        const float r = a.radius + b.radius;
+        bool overlap = true;
+
+        for (int axis = 0; axis < sizeof(d) / sizeof(float); ++axis)
+        {
+            overlap &= fabsf(Component(d, axis)) < r;
+        }
+        return overlap;
+    }
+
+    // every ball checks the cells around it and keeps the pairs where it has the lower index, so each
+    // pair comes out exactly once (a ball is only ever in one cell, there's nothing to deduplicate).
+    // The balls are split across the threads and each chunk of them collects its pairs in its own list
+    template <int D>
+    void FindPairsGrid(const UniformGrid<D>& grid, const std::vector<typename Dimension<D>::Body>& balls, std::vector<CollisionPair>& pairs,
+                       ChunkLists<CollisionPair>& lists)
+    {
+        Parallel::Collect(0, (int)balls.size(), lists, pairs, [&](int start, int stop, std::vector<CollisionPair>& out)
+        {
+            for (int i = start; i < stop; ++i)
+            {
+                int coord[3] = { 0, 0, 0 };
+                for (int axis = 0; axis < D; ++axis)
+                {
+                    coord[axis] = GridCoord(grid, Position(balls[i]), axis);
+                }
+
+                const int z_lo = (D == 3) ? std::max(coord[2] - 1, 0) : 0;
+                const int z_hi = (D == 3) ? std::min(coord[2] + 1, grid.dims[2] - 1) : 0;
+
+                for (int z = z_lo; z <= z_hi; ++z)
+                {
+                    for (int y = std::max(coord[1] - 1, 0); y <= std::min(coord[1] + 1, grid.dims[1] - 1); ++y)
+                    {
+                        for (int x = std::max(coord[0] - 1, 0); x <= std::min(coord[0] + 1, grid.dims[0] - 1); ++x)
+                        {
+                            const int cell = (z * grid.dims[1] + y) * grid.dims[0] + x;
+
+                            for (int j = grid.cell_head[cell]; j != -1; j = grid.next[j])
+                            {
+                                if (j > i && BoundsOverlap(balls[i], balls[j]))
+                                {
+                                    out.push_back(CollisionPair{ i, j });
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    // same walk as FindPairsGrid(), a cell's balls come from a run of the sorted order
+    template <int D>
+    void FindPairsSorted(const SortedGrid<D>& grid, const std::vector<typename Dimension<D>::Body>& balls, std::vector<CollisionPair>& pairs,
+                         ChunkLists<CollisionPair>& lists)
+    {
+        const UniformGrid<D>& cells = grid.cells;
+
+        Parallel::Collect(0, (int)balls.size(), lists, pairs, [&](int start, int stop, std::vector<CollisionPair>& out)
+        {
+            for (int i = start; i < stop; ++i)
+            {
+                int coord[3] = { 0, 0, 0 };
+                for (int axis = 0; axis < D; ++axis)
+                {
+                    coord[axis] = GridCoord(cells, Position(balls[i]), axis);
+                }
+
+                const int z_lo = (D == 3) ? std::max(coord[2] - 1, 0) : 0;
+                const int z_hi = (D == 3) ? std::min(coord[2] + 1, cells.dims[2] - 1) : 0;
+
+                for (int z = z_lo; z <= z_hi; ++z)
+                {
+                    for (int y = std::max(coord[1] - 1, 0); y <= std::min(coord[1] + 1, cells.dims[1] - 1); ++y)
+                    {
+                        // a row of up to 3 cells is one run
+                        const int row = (z * cells.dims[1] + y) * cells.dims[0];
+                        const int begin = grid.cell_start[row + std::max(coord[0] - 1, 0)];
+                        const int end = grid.cell_start[row + std::min(coord[0] + 1, cells.dims[0] - 1) + 1];
+
+                        for (int k = begin; k < end; ++k)
+                        {
+                            const int j = grid.order[k];
+                            if (j > i && BoundsOverlap(balls[i], balls[j]))
+                            {
+                                out.push_back(CollisionPair{ i, j });
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    // the low indices have the most partners to check, small chunks even that out between the threads
+    template <typename Body>
+    void FindPairsBrute(const std::vector<Body>& balls, std::vector<CollisionPair>& pairs, ChunkLists<CollisionPair>& lists)
+    {
+        Parallel::Collect(0, (int)balls.size(), lists, pairs, [&](int start, int stop, std::vector<CollisionPair>& out)
+        {
+            for (int i = start; i < stop; ++i)
+            {
+                for (int j = i + 1; j < balls.size(); ++j)
+                {
+                    if (BoundsOverlap(balls[i], balls[j]))
+                    {
+                        out.push_back(CollisionPair{ i, j });
+                    }
+                }
+            }
+        }, 16);
+    }
+
+    template <typename Body, typename Vec>
+    void Narrowphase(const std::vector<Body>& balls, const std::vector<CollisionPair>& pairs, std::vector<Contact<Vec>>& contacts,
+                     ChunkLists<Contact<Vec>>& lists)
+    {
+        Parallel::Collect(0, (int)pairs.size(), lists, contacts, [&](int start, int stop, std::vector<Contact<Vec>>& out)
+        {
+            for (int p = start; p < stop; ++p)
+            {
+                const Body& a = balls[pairs[p].a];
+                const Body& b = balls[pairs[p].b];
+
+                Vec d = Position(b) - Position(a);
+                float dist2 = Dot(d, d);
+                float r = a.radius + b.radius;
+
+                if (dist2 >= r * r)
+                {
+                    continue;
+                }
+
+                // two balls right on top of each other get pushed apart along x
+                float dist = sqrtf(dist2);
+                Vec normal = {};
+                if (dist > 1e-6f)
+                {
+                    normal = d * (1.0f / dist);
+                }
+                else
+                {
+                    Component(normal, 0) = 1.0f;
+                }
+
+                out.push_back(Contact<Vec>{ pairs[p].a, pairs[p].b, normal, r - dist });
+            }
+        }, 1024);
+    }
+
+    // one pass of sequential impulses, restitution 1 is perfectly bouncy and 0 is dead
+    template <typename Body, typename Vec>
+    void SolveContacts(std::vector<Body>& balls, const std::vector<Contact<Vec>>& contacts, const float restitution)
+    {
+        for (int c = 0; c < contacts.size(); ++c)
+        {
+            Body& a = balls[contacts[c].a];
+            Body& b = balls[contacts[c].b];
+            const Vec& n = contacts[c].normal;
+
+            const float inv_a = 1.0f / BallMass(a);
+            const float inv_b = 1.0f / BallMass(b);
+            const float inv_sum = inv_a + inv_b;
+
+            // separate them so they aren't still overlapping next step
+            Vec push = n * (contacts[c].depth / inv_sum);
+            Position(a) = Position(a) - push * inv_a;
+            Position(b) = Position(b) + push * inv_b;
+
+            // only bounce if they're moving towards each other
+            float closing = Dot(b.velocity - a.velocity, n);
+            if (closing < 0.0f)
+            {
+                Vec impulse = n * (-(1.0f + restitution) * closing / inv_sum);
+                a.velocity = a.velocity - impulse * inv_a;
+                b.velocity = b.velocity + impulse * inv_b;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,504 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "defs.h"
+#include "forces.h"
+#include "collisions.h"
+#include "pool.h"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+
+// everything that used to be hard coded in main.cc, read once at startup from a config file
+// (sim.cfg unless --config says otherwise) and then from the command line, which wins. Both use
+// the same "key values..." lines, on the command line it's "--key values...", so
+//   ./main --balls 20000 --radius 1 3 --threads 4 --headless --steps 600
+// is the same as a config file with those four lines. See sim.cfg for every key. Force field
+// lines (gravity, attractor, nbody...) can go in the config too, next to or instead of a forces file
+
+namespace Config
+{
+    typedef struct SimConfig
+    {
+        // window
+        int width = 512;
+        int height = 512;
+        int fps = 120;
+        std::string render = "balls";           // or "density"
+        std::vector<Color> palette;             // empty means the usual ten colours
+        float mesh_cache_mb = 8.0f;             // GPU meshes kept for ellipses, cylinders and the textured cube before the oldest go
+
+        // balls
+        int balls = 50;
+        float spawn_rate = 2000.0f;             // balls a second added or removed when the count changes while running, 0 is all at once
+        std::vector<Physics::Spawner> spawners; // 2D only
+        std::vector<Physics::Sink> sinks;
+        float radius_min = 20.0f;               // radii are uniform between these
+        float radius_max = 20.0f;
+        float speed_min = 250.0f;               // so are speeds, in a random direction on each axis
+        float speed_max = 500.0f;
+        unsigned seed = 0;                      // 0 picks a new one every run (headless uses 1234 so it's repeatable)
+
+        // physics
+        int threads = 0;                        // 0 is one per core
+        Physics::BroadphaseType broadphase = Physics::BROADPHASE_GRID;
+        std::string integrator = "semi-implicit";
+        bool collisions = true;
+        float restitution = 1.0f;
+        int reorder_every = 0;                  // sort the balls into Z-order every so many steps, 0 for never
+        float reorder_disorder = 1.0f;          // or once there were this many grid cell changes per ball, 0 for never
+        std::string forces;                     // force file on top of any force lines here, empty is forces.cfg (forces3d.cfg in 3D)
+        std::vector<std::string> force_lines;
+
+        // running
+        bool mode_3d = false;
+        bool headless = false;
+        int steps = 120;                        // headless only
+        std::string output = "frame.png";       // headless frame, or the diff image with --golden
+        std::string golden;
+        bool bless = false;                     // with golden, write this run's frame as the new reference
+        std::string record;
+        std::string path;                       // the config file that was read, for reloading
+        std::vector<std::string> args;          // the command line, which still wins after a reload
+
+    } SimConfig;
+
+    inline bool ParseBool(const std::string& value, bool fallback)
+    {
+        if (value == "on" || value == "true" || value == "yes" || value == "1")
+        {
+            return true;
+        }
+        if (value == "off" || value == "false" || value == "no" || value == "0")
+        {
+            return false;
+        }
+        return fallback;
+    }
+
+    inline bool ParseColor(const std::string& name, Color& color)
+    {
+        static const struct { const char* name; Color color; } colors[] = {
+            { "red", RED }, { "blue", BLUE }, { "green", GREEN }, { "magenta", MAGENTA }, { "maroon", MAROON },
+            { "pink", PINK }, { "purple", PURPLE }, { "orange", ORANGE }, { "yellow", YELLOW }, { "lime", LIME },
+            { "gold", GOLD }, { "skyblue", SKYBLUE }, { "darkblue", DARKBLUE }, { "darkgreen", DARKGREEN },
+            { "violet", VIOLET }, { "darkpurple", DARKPURPLE }, { "brown", BROWN }, { "beige", BEIGE },
+            { "gray", GRAY }, { "darkgray", DARKGRAY }, { "black", BLACK }, { "white", WHITE }
+        };
+
+        for (int i = 0; i < sizeof(colors) / sizeof(colors[0]); ++i)
+        {
+            if (name == colors[i].name)
+            {
+                color = colors[i].color;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // one "key values..." line, returns false if the key isn't a setting (it might still be a force)
+    inline bool ParseConfigLine(const std::string& line, SimConfig& config)
+    {
+        std::istringstream in(line);
+        std::string key;
+
+        if (!(in >> key) || key[0] == '#')
+        {
+            return true;            // blank lines and comments are fine
+        }
+
+        std::string value;
+        if (key == "width")                 in >> config.width;
+        else if (key == "height")           in >> config.height;
+        else if (key == "fps")              in >> config.fps;
+        else if (key == "render")           in >> config.render;
+        else if (key == "balls")            in >> config.balls;
+        else if (key == "spawn_rate")       in >> config.spawn_rate;
+        else if (key == "seed")             in >> config.seed;
+        else if (key == "threads")          in >> config.threads;
+        else if (key == "integrator")       in >> config.integrator;
+        else if (key == "restitution")      in >> config.restitution;
+        else if (key == "forces")           in >> config.forces;
+        else if (key == "steps")            in >> config.steps;
+        else if (key == "output")           in >> config.output;
+        else if (key == "golden")           in >> config.golden;
+        else if (key == "record")           in >> config.record;
+        else if (key == "mesh_cache")       in >> config.mesh_cache_mb;
+        else if (key == "radius")
+        {
+            in >> config.radius_min;
+            config.radius_max = config.radius_min;
+            in >> config.radius_max;        // optional
+        }
+        else if (key == "speed")
+        {
+            in >> config.speed_min;
+            config.speed_max = config.speed_min;
+            in >> config.speed_max;
+        }
+        else if (key == "reorder")
+        {
+            in >> config.reorder_every;
+            in >> config.reorder_disorder;  // optional
+        }
+        else if (key == "broadphase")
+        {
+            in >> value;
+            config.broadphase = (value == "brute") ? Physics::BROADPHASE_BRUTE : (value == "sorted") ? Physics::BROADPHASE_SORTED : Physics::BROADPHASE_GRID;
+        }
+        else if (key == "collisions")
+        {
+            config.collisions = (in >> value) ? ParseBool(value, config.collisions) : true;
+        }
+        else if (key == "bless")
+        {
+            config.bless = (in >> value) ? ParseBool(value, config.bless) : true;
+        }
+        else if (key == "headless")
+        {
+            config.headless = (in >> value) ? ParseBool(value, config.headless) : true;
+        }
+        else if (key == "mode")
+        {
+            in >> value;
+            config.mode_3d = (value == "3d");
+        }
+        else if (key == "palette")
+        {
+            config.palette.clear();
+            while (in >> value)
+            {
+                Color color;
+                if (value != "default" && ParseColor(value, color))
+                {
+                    config.palette.push_back(color);
+                }
+                else if (value != "default")
+                {
+                    std::cout << "WARNING: unknown colour '" << value << "'" << std::endl;
+                }
+            }
+        }
+        else if (key == "spawner" || key == "sink")
+        {
+            Physics::Spawner spawner;
+            Physics::Sink sink;
+            if (Physics::ParseSpawner(line, spawner))
+            {
+                config.spawners.push_back(spawner);
+            }
+            else if (Physics::ParseSink(line, sink))
+            {
+                config.sinks.push_back(sink);
+            }
+            else
+            {
+                std::cout << "WARNING: couldn't read '" << line << "'" << std::endl;
+            }
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    // a setting, a force field, or a warning
+    inline void ApplyConfigLine(const std::string& line, SimConfig& config)
+    {
+        if (ParseConfigLine(line, config))
+        {
+            return;
+        }
+
+        Physics::ForceField field;
+        Physics::NBodySettings nbody;
+        std::string error;
+        if (Physics::ParseNBodySettings(line, nbody, &error) || (error.empty() && Physics::ParseForceField(line, field, &error)))
+        {
+            config.force_lines.push_back(line);
+        }
+        else if (!error.empty())
+        {
+            std::cout << "WARNING: " << error << std::endl;
+        }
+    }
+
+    inline bool LoadConfigFile(const std::string& path, SimConfig& config)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            return false;
+        }
+
+        config.force_lines.clear();
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            ApplyConfigLine(line, config);
+        }
+        return true;
+    }
+
+    // the 3D box is 10 metres across, so it starts from different numbers
+    inline void Defaults3D(SimConfig& config)
+    {
+        config.width = 800;
+        config.height = 600;
+        config.balls = 3000;
+        config.radius_min = 0.08f;
+        config.radius_max = 0.2f;
+        config.speed_min = 0.0f;
+        config.speed_max = 4.0f;
+    }
+
+    inline bool ReadConfig(const std::vector<std::string>& args, SimConfig& config)
+    {
+        const int argc = args.size();
+
+        config.args = args;
+        config.path = "sim.cfg";
+        for (int i = 0; i + 1 < argc; ++i)
+        {
+            if (args[i] == "--config")
+            {
+                config.path = args[i + 1];
+                if (!LoadConfigFile(config.path, config))
+                {
+                    std::cout << "couldn't read config " << config.path << std::endl;
+                    return false;
+                }
+            }
+        }
+
+        if (config.path == "sim.cfg")
+        {
+            LoadConfigFile(config.path, config);        // fine if it isn't there
+        }
+
+        for (int i = 0; i < argc; ++i)
+        {
+            const std::string& arg = args[i];
+
+            if (arg == "3d")
+            {
+                config.mode_3d = true;
+                continue;
+            }
+            if (arg.size() < 3 || arg.compare(0, 2, "--") != 0)
+            {
+                std::cout << "unexpected argument '" << arg << "'" << std::endl;
+                return false;
+            }
+
+            // gather the values up to the next --key
+            std::string line = arg.substr(2);
+            while (i + 1 < argc && args[i + 1].compare(0, 2, "--") != 0)
+            {
+                line += " ";
+                line += args[++i];
+            }
+
+            if (line.compare(0, 7, "config ") == 0)
+            {
+                continue;
+            }
+            ApplyConfigLine(line, config);
+        }
+
+        if (!config.golden.empty())
+        {
+            config.headless = true;
+        }
+        return true;
+    }
+
+    // the config file first, then every "--key values..." on the command line on top.
+    // A bare "3d" still means --mode 3d, which reads everything again over the 3D defaults.
+    // Returns false if the command line makes no sense
+    inline bool LoadConfig(const std::vector<std::string>& args, SimConfig& config)
+    {
+        if (!ReadConfig(args, config))
+        {
+            return false;
+        }
+
+        if (config.mode_3d)
+        {
+            config = SimConfig();
+            Defaults3D(config);
+            ReadConfig(args, config);
+        }
+        return true;
+    }
+
+    inline bool LoadConfig(int argc, char** argv, SimConfig& config)
+    {
+        return LoadConfig(std::vector<std::string>(argv + 1, argv + argc), config);
+    }
+
+    // the config's force lines, then the forces file on top ("forces none" skips the file)
+    inline void LoadForces(const SimConfig& config, std::vector<Physics::ForceField>& fields, Physics::NBodySettings& nbody)
+    {
+        for (int i = 0; i < config.force_lines.size(); ++i)
+        {
+            Physics::ForceField field;
+            if (Physics::ParseNBodySettings(config.force_lines[i], nbody))
+            {
+                continue;
+            }
+            if (Physics::ParseForceField(config.force_lines[i], field))
+            {
+                fields.push_back(field);
+            }
+        }
+
+        if (config.forces != "none")
+        {
+            const std::string default_path = config.mode_3d ? "forces3d.cfg" : "forces.cfg";
+            std::vector<std::string> errors;
+            Physics::LoadForceFields(config.forces.empty() ? default_path : config.forces, fields, nbody, errors);
+            for (int i = 0; i < errors.size(); ++i)
+            {
+                std::cout << "WARNING: " << errors[i] << std::endl;
+            }
+        }
+    }
+
+    // hot reloading. inotify watches the directories the config and forces files live in (editors
+    // usually save by writing a new file and renaming it over the old one, which a watch on the
+    // file itself would lose), and the window checks it once a frame without ever blocking
+    typedef struct ConfigWatcher
+    {
+        int fd = -1;
+        std::vector<std::string> files;         // names we care about inside the watched directories
+
+    } ConfigWatcher;
+
+    inline void SplitPath(const std::string& path, std::string& directory, std::string& name)
+    {
+        const size_t slash = path.find_last_of('/');
+        directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+        name = slash == std::string::npos ? path : path.substr(slash + 1);
+    }
+
+    inline bool StartConfigWatcher(ConfigWatcher& watcher, const SimConfig& config)
+    {
+        watcher.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (watcher.fd < 0)
+        {
+            std::cout << "WARNING: couldn't start watching " << config.path << ", no hot reloading" << std::endl;
+            return false;
+        }
+
+        std::vector<std::string> paths = { config.path };
+        if (config.forces != "none")
+        {
+            paths.push_back(config.forces.empty() ? (config.mode_3d ? "forces3d.cfg" : "forces.cfg") : config.forces);
+        }
+
+        for (int i = 0; i < paths.size(); ++i)
+        {
+            std::string directory, name;
+            SplitPath(paths[i], directory, name);
+
+            // watching the same directory twice just hands back the same watch
+            if (inotify_add_watch(watcher.fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) >= 0)
+            {
+                watcher.files.push_back(name);
+            }
+        }
+        return true;
+    }
+
+    // true if one of the files was written since the last call, drains every event either way
+    inline bool ConfigChanged(ConfigWatcher& watcher)
+    {
+        if (watcher.fd < 0)
+        {
+            return false;
+        }
+
+        alignas(inotify_event) char buffer[16 * (sizeof(inotify_event) + NAME_MAX + 1)];
+        bool changed = false;
+        ssize_t length;
+
+        while ((length = read(watcher.fd, buffer, sizeof(buffer))) > 0)
+        {
+            for (char* p = buffer; p < buffer + length; p += sizeof(inotify_event) + ((inotify_event*)p)->len)
+            {
+                const inotify_event* event = (const inotify_event*)p;
+                if (event->len == 0)
+                {
+                    continue;
+                }
+
+                for (int i = 0; i < watcher.files.size(); ++i)
+                {
+                    changed |= watcher.files[i] == event->name;
+                }
+            }
+        }
+        return changed;
+    }
+
+    inline void StopConfigWatcher(ConfigWatcher& watcher)
+    {
+        if (watcher.fd >= 0)
+        {
+            close(watcher.fd);
+            watcher.fd = -1;
+        }
+    }
+
+    // reads everything again and copies over only what can change under a running simulation
+    // (forces, restitution, render mode, thread count, ball count, spawn rate, spawners, sinks,
+    // broadphase, reordering and integrator), anything else that changed gets a warning since it needs a restart.
+    // Returns false if the files didn't parse
+    inline bool ReloadConfig(SimConfig& config)
+    {
+        SimConfig fresh;
+        if (!LoadConfig(config.args, fresh))
+        {
+            return false;
+        }
+
+        if (fresh.width != config.width || fresh.height != config.height || fresh.fps != config.fps ||
+            fresh.radius_min != config.radius_min || fresh.radius_max != config.radius_max || fresh.speed_min != config.speed_min ||
+            fresh.speed_max != config.speed_max || fresh.seed != config.seed || fresh.collisions != config.collisions ||
+            fresh.mode_3d != config.mode_3d)
+        {
+            std::cout << "WARNING: size, fps, radius, speed, seed, collisions and mode need a restart" << std::endl;
+        }
+
+        config.forces = fresh.forces;
+        config.force_lines = fresh.force_lines;
+        config.restitution = fresh.restitution;
+        config.render = fresh.render;
+        config.mesh_cache_mb = fresh.mesh_cache_mb;
+        config.threads = fresh.threads;
+        config.balls = fresh.balls;
+        config.spawn_rate = fresh.spawn_rate;
+        config.spawners = fresh.spawners;
+        config.sinks = fresh.sinks;
+        config.broadphase = fresh.broadphase;
+        config.reorder_every = fresh.reorder_every;
+        config.reorder_disorder = fresh.reorder_disorder;
+        config.integrator = fresh.integrator;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include "defs.h"
+
+#include <vector>
+#include <cmath>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// view frustum culling, nothing off screen should reach the GPU. The planes come straight out of
+// the camera's view-projection matrix and bounding spheres are tested 4 at a time with SSE
+
+namespace Graphics
+{
+    typedef struct Frustum
+    {
+        Vector4 planes[6];      // xyz normal pointing inwards, w distance, so inside means dot(n, p) + w >= 0
+
+    } Frustum;
+
+    typedef struct CullStats
+    {
+        int tested;
+        int submitted;
+        int culled;
+
+    } CullStats;
+
+    // bounding spheres laid out one array per component so 4 of them load straight into SSE registers
+    typedef struct CullBatch
+    {
+        std::vector<float> x, y, z, r;
+        std::vector<int> visible;       // indices of everything that survived
+
+    } CullBatch;
+
+    // Gribb-Hartmann, each plane is the w row of the clip matrix plus or minus one of the other rows
+    inline Frustum ExtractFrustum(const Camera3D& cam, float aspect)
+    {
+        Matrix view = MatrixLookAt(cam.position, cam.target, cam.up);
+        Matrix proj = MatrixPerspective(cam.fovy * DEG2RAD, aspect, RL_CULL_DISTANCE_NEAR, RL_CULL_DISTANCE_FAR);
+        Matrix m = MatrixMultiply(view, proj);
+
+        // raylib matrices are column major, row i of the maths matrix is (m[i], m[i + 4], m[i + 8], m[i + 12])
+        const Vector4 row0 = { m.m0, m.m4, m.m8, m.m12 };
+        const Vector4 row1 = { m.m1, m.m5, m.m9, m.m13 };
+        const Vector4 row2 = { m.m2, m.m6, m.m10, m.m14 };
+        const Vector4 row3 = { m.m3, m.m7, m.m11, m.m15 };
+
+        Frustum f;
+        f.planes[0] = Vector4Add(row3, row0);           // left
+        f.planes[1] = Vector4Subtract(row3, row0);      // right
+        f.planes[2] = Vector4Add(row3, row1);           // bottom
+        f.planes[3] = Vector4Subtract(row3, row1);      // top
+        f.planes[4] = Vector4Add(row3, row2);           // near
+        f.planes[5] = Vector4Subtract(row3, row2);      // far
+
+        for (int p = 0; p < 6; ++p)
+        {
+            float len = sqrtf(f.planes[p].x * f.planes[p].x + f.planes[p].y * f.planes[p].y + f.planes[p].z * f.planes[p].z);
+            f.planes[p] = Vector4Scale(f.planes[p], 1.0f / len);
+        }
+
+        return f;
+    }
+
+    // the frustum the screen is currently showing from this camera
+    inline Frustum ExtractFrustum(const Camera3D& cam)
+    {
+        return ExtractFrustum(cam, (float)GetScreenWidth() / (float)GetScreenHeight());
+    }
+
+    // single object test, for the cubes and cylinders queued one at a time (see QueueCube() in render3d.h)
+    inline bool SphereInFrustum(const Frustum& f, const Vector3& center, float radius)
+    {
+        for (int p = 0; p < 6; ++p)
+        {
+            if (f.planes[p].x * center.x + f.planes[p].y * center.y + f.planes[p].z * center.z + f.planes[p].w < -radius)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    inline void ClearCullBatch(CullBatch& batch)
+    {
+        batch.x.clear();
+        batch.y.clear();
+        batch.z.clear();
+        batch.r.clear();
+    }
+
+    inline void AddToCullBatch(CullBatch& batch, const Vector3& center, float radius)
+    {
+        batch.x.push_back(center.x);
+        batch.y.push_back(center.y);
+        batch.z.push_back(center.z);
+        batch.r.push_back(radius);
+    }
+
+    // fills batch.visible with the index of every bounding sphere that's at least partly inside
+    inline void CullSpheres(const Frustum& f, CullBatch& batch, CullStats& stats)
+    {
+        const int n = batch.x.size();
+        int i = 0;
+
+        batch.visible.clear();
+
+#if defined(__SSE2__)
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(&batch.x[i]);
+            __m128 y = _mm_loadu_ps(&batch.y[i]);
+            __m128 z = _mm_loadu_ps(&batch.z[i]);
+            __m128 neg_r = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&batch.r[i]));
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+            for (int p = 0; p < 6; ++p)
+            {
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(f.planes[p].x)), _mm_mul_ps(y, _mm_set1_ps(f.planes[p].y))),
+                                      _mm_add_ps(_mm_mul_ps(z, _mm_set1_ps(f.planes[p].z)), _mm_set1_ps(f.planes[p].w)));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(d, neg_r));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            for (int k = 0; k < 4; ++k)
+            {
+                if (mask & (1 << k))
+                {
+                    batch.visible.push_back(i + k);
+                }
+            }
+        }
+#endif
+
+        // whatever doesn't fill a group of 4 (or everything without SSE)
+        for (; i < n; ++i)
+        {
+            if (SphereInFrustum(f, Vector3{ batch.x[i], batch.y[i], batch.z[i] }, batch.r[i]))
+            {
+                batch.visible.push_back(i);
+            }
+        }
+
+        stats.tested += n;
+        stats.submitted += batch.visible.size();
+        stats.culled += n - (int)batch.visible.size();
+    }
+};
+
+#endif
@@ -9,6 +9,8 @@
 #include <raymath.h>
 #include <iostream>
 
+#include "meshcache.h"
+
 // this is where I will define many structs I will use for rendering
 
 namespace Raylib
@@ -124,6 +126,10 @@ namespace Raylib
 
         void CustomDrawText() { DrawText(text.c_str(), x, y, fontSize, color); }
 
+        // the same, onto any canvas (see canvas.h), e.g. the software rasterizer
+        template <typename Canvas>
+        void CustomDrawText(Canvas& canvas) { CanvasText(canvas, text, x, y, fontSize, color); }
+
     } Text;
 
     typedef struct CustomTexture2D
@@ -167,6 +173,12 @@ namespace Raylib
 
         void DrawRectLines(const Color& border) { DrawRectangleLines(x, y, width, height, border); }
 
+        template <typename Canvas>
+        void DrawFilledRect(Canvas& canvas) { CanvasRectangle(canvas, x, y, width, height, color); }
+
+        template <typename Canvas>
+        void DrawRectLines(Canvas& canvas, const Color& border) { CanvasRectangleLines(canvas, x, y, width, height, border); }
+
         void DrawGradVRect(const Color& top, const Color& bottom) { DrawRectangleGradientV(x, y, width, height, top, bottom); }
 
         void DrawGradHRect(const Color& left, const Color& right) { DrawRectangleGradientH(x, y, width, height, left, right); }
@@ -203,6 +215,15 @@ namespace Raylib
             this->rotation_angle = 0.0f;
         }
 
+        // model matrix for a unit cube centred on the origin, the same transform Draw3DCube() builds
+        // with the rlgl matrix stack (scale to size, spin rotation_angle degrees around y, then move)
+        Matrix GetTransform()
+        {
+            Matrix scale = MatrixScale(width, height, length);
+            Matrix rotate = MatrixRotateY(rotation_angle * DEG2RAD);
+            return MatrixMultiply(MatrixMultiply(scale, rotate), MatrixTranslate(position.x, position.y, position.z));
+        }
+
         void Draw3DCube()
         {
             rlPushMatrix();
@@ -354,6 +375,12 @@ namespace Raylib
         void DrawCircleOutline(const Color& border) { DrawCircleLines(position.x, position.y, radius, border); }
         void DrawGradCircle(const Color& inner, const Color& outer) { DrawCircleGradient(position.x, position.y, radius, inner, outer); } 
 
+        template <typename Canvas>
+        void DrawFilledCircle(Canvas& canvas) { CanvasCircle(canvas, position, radius, color); }
+
+        template <typename Canvas>
+        void DrawCircleOutline(Canvas& canvas, const Color& border) { CanvasCircleLines(canvas, position, radius, border); }
+
     } Circle;
 
     typedef struct Ellipse
@@ -373,7 +400,19 @@ namespace Raylib
             this->color = color;
         }
 
-        void DrawFilledEllipse() { DrawEllipse(centerX, centerY, radiusH, radiusV, color); }
+        // the fan is tessellated once per size and cached
+        Graphics::MeshHandle FindEllipseMesh()
+        {
+            Graphics::MeshKey key = { Graphics::MESH_ELLIPSE, { Graphics::QuantizeParam(radiusH), Graphics::QuantizeParam(radiusV), 0, 0 },
+                                      Graphics::EllipseSegments(fmaxf(radiusH, radiusV)) };
+            return Graphics::FindOrBuildMesh(Graphics::mesh_cache, key, Graphics::BuildEllipse);
+        }
+
+        void DrawFilledEllipse() { Graphics::DrawCachedMesh(Graphics::mesh_cache, FindEllipseMesh(), color, MatrixTranslate(centerX, centerY, 0.0f)); }
+
+        // for lots of them, Graphics::DrawQueuedMeshes() draws every queued ellipse of a size and colour at once
+        void QueueFilledEllipse() { Graphics::QueueCachedMesh(Graphics::mesh_cache, FindEllipseMesh(), color, MatrixTranslate(centerX, centerY, 0.0f)); }
+
         void DrawEllipseOutline(const Color& border) { DrawEllipseLines(centerX, centerY, radiusH, radiusV, border); }
 
     } Ellipse;
@@ -383,6 +422,7 @@ namespace Raylib
         Vector3 centerPos;
         float radius;
         Color color;
+        Vector3 velocity;
 
         void CreateSphere(const Vector3& centerP, float r, const Color& c)
         {
@@ -431,6 +471,9 @@ namespace Raylib
 
         void DrawLineFilled() { DrawLine(start.x, start.y, end.x, end.y, color); }
 
+        template <typename Canvas>
+        void DrawLineFilled(Canvas& canvas) { CanvasLine(canvas, start, end, color); }
+
     } Line;
 
     typedef struct Cylinder
@@ -452,85 +495,55 @@ namespace Raylib
             this->color = c;
         }
 
-        void Draw3DCylinder() { DrawCylinder(position, radiusTop, radiusBottom, height, slices, color); }
+        Graphics::MeshHandle FindCylinderMesh()
+        {
+            Graphics::MeshKey key = { Graphics::MESH_CYLINDER, { Graphics::QuantizeParam(radiusTop), Graphics::QuantizeParam(radiusBottom), Graphics::QuantizeParam(height), 0 },
+                                      slices < 3 ? 3 : slices };
+            return Graphics::FindOrBuildMesh(Graphics::mesh_cache, key, Graphics::BuildCylinder);
+        }
+
+        void Draw3DCylinder() { Graphics::DrawCachedMesh(Graphics::mesh_cache, FindCylinderMesh(), color, MatrixTranslate(position.x, position.y, position.z)); }
+
+        // like QueueFilledEllipse(), DrawQueuedMeshes() has to run inside the same BeginMode3D()
+        void Queue3DCylinder() { Graphics::QueueCachedMesh(Graphics::mesh_cache, FindCylinderMesh(), color, MatrixTranslate(position.x, position.y, position.z)); }
+
         void Draw3DCylinderLines(const Color& border) { DrawCylinderWires(position, radiusTop, radiusBottom, height, slices, border); }
 
     } Cylinder;
 
-    void DrawTexturedCube(const Texture2D& tex, const Shader& shader)
+    // a cube of its own from -1 to 1, uploaded, the caller unloads it
+    inline Mesh CreateTexturedCube()
+    {
+        Graphics::MeshKey key = { Graphics::MESH_TEXTURED_CUBE, { Graphics::QuantizeParam(2.0f), 0, 0, 0 }, 0 };
+        Mesh mesh = Graphics::BuildTexturedCube(key);
+        UploadMesh(&mesh, true);
+        return mesh;
+    }
+
+    // the shared one in the mesh cache, looked up (and built the first time)
+    inline Graphics::MeshHandle FindTexturedCube(float size = 2.0f)
     {
-        rlEnableShader(shader.id);
-        rlEnableTexture(tex.id);
-        rlBegin(RL_QUADS);
-
-        // Front face
-        rlTexCoord2f(0, 0); rlVertex3f(-1, -1, -1);
-        rlTexCoord2f(1, 0); rlVertex3f( 1, -1, -1);
-        rlTexCoord2f(1, 1); rlVertex3f( 1,  1, -1);
-        rlTexCoord2f(0, 1); rlVertex3f(-1,  1, -1);
-
-        // Back face
-        rlTexCoord2f(1, 0); rlVertex3f(-1, -1,  1);
-        rlTexCoord2f(1, 1); rlVertex3f(-1,  1,  1);
-        rlTexCoord2f(0, 1); rlVertex3f( 1,  1,  1);
-        rlTexCoord2f(0, 0); rlVertex3f( 1, -1,  1);
-
-        rlEnd();
-        rlDisableTexture();
-        rlDisableShader();
+        Graphics::MeshKey key = { Graphics::MESH_TEXTURED_CUBE, { Graphics::QuantizeParam(size), 0, 0, 0 }, 0 };
+        return Graphics::FindOrBuildMesh(Graphics::mesh_cache, key, Graphics::BuildTexturedCube);
     }
 
-    Mesh CreateTexturedCube()
+    // all 6 faces straight from the cached VBOs, nothing gets sent per vertex
+    inline void DrawTexturedCube(const Texture2D& tex, const Shader& shader, const Matrix& transform)
     {
-        Mesh mesh = { 0 };
-        mesh.triangleCount = 12;
-        mesh.vertexCount = 24;
-
-        mesh.vertices = (float *)MemAlloc(mesh.vertexCount * 3 * sizeof(float));
-        mesh.texcoords = (float *)MemAlloc(mesh.vertexCount * 2 * sizeof(float));
-        mesh.indices = (unsigned short *)MemAlloc(mesh.triangleCount * 3 * sizeof(unsigned short));
-
-        float verts[] = {
-            // Front face
-            -1, -1, -1,  1, -1, -1,  1,  1, -1, -1,  1, -1,
-            // Back face
-            -1, -1,  1, -1,  1,  1,  1,  1,  1,  1, -1,  1,
-            // Left face
-            -1, -1, -1, -1,  1, -1, -1,  1,  1, -1, -1,  1,
-            // Right face
-            1, -1, -1,  1, -1,  1,  1,  1,  1,  1,  1, -1,
-            // Top face
-            -1,  1, -1,  1,  1, -1,  1,  1,  1, -1,  1,  1,
-            // Bottom face
-            -1, -1, -1, -1, -1,  1,  1, -1,  1,  1, -1, -1
-        };
-
-        float uvs[] = {
-            0, 0,  1, 0,  1, 1,  0, 1,
-            1, 0,  1, 1,  0, 1,  0, 0,
-            0, 0,  1, 0,  1, 1,  0, 1,
-            1, 0,  1, 1,  0, 1,  0, 0,
-            0, 1,  1, 1,  1, 0,  0, 0,
-            0, 1,  1, 1,  1, 0,  0, 0
-        };
-
-        unsigned short indices[] = {
-            0, 1, 2,  0, 2, 3,    // Front
-            4, 5, 6,  4, 6, 7,    // Back
-            8, 9,10,  8,10,11,    // Left
-            12,13,14, 12,14,15,   // Right
-            16,17,18, 16,18,19,   // Top
-            20,21,22, 20,22,23    // Bottom
-        };
-
-        memcpy(mesh.vertices, verts, sizeof(verts));
-        memcpy(mesh.texcoords, uvs, sizeof(uvs));
-        memcpy(mesh.indices, indices, sizeof(indices));
+        MaterialMap maps[MAX_MATERIAL_MAPS] = {};
+        maps[MATERIAL_MAP_DIFFUSE].texture = tex;
+        maps[MATERIAL_MAP_DIFFUSE].color = WHITE;
 
-        UploadMesh(&mesh, true);
-        return mesh;
+        Material material = {};
+        material.shader = shader;
+        material.maps = maps;
+
+        DrawMesh(Graphics::GetMesh(Graphics::mesh_cache, FindTexturedCube()), material, transform);
     }
 
+    // at the origin like it always was
+    inline void DrawTexturedCube(const Texture2D& tex, const Shader& shader) { DrawTexturedCube(tex, shader, MatrixIdentity()); }
+
     void RotateModel(Model *model, float angle, Vector3 axis)
     {
         Matrix rotation = MatrixRotate(axis, angle * DEG2RAD);
@@ -0,0 +1,161 @@
+#ifndef DENSITY_H
+#define DENSITY_H
+
+#include "defs.h"
+#include "parallel.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// density view for ball counts where drawing every ball is pointless. Ball centres get binned into a
+// grid (every chunk of balls fills its own histogram, then the histograms are summed cell by cell), the counts
+// are coloured through a colormap and the whole thing goes to the GPU as one texture, so drawing costs
+// the same however many balls there are
+
+namespace Graphics
+{
+    typedef struct DensityMap
+    {
+        int width = 0;                      // cells
+        int height = 0;
+        Vector2 world_min, world_max;       // the area the grid covers
+        std::vector<std::vector<unsigned>> chunk_counts;     // scratch, one histogram per chunk of balls
+        std::vector<unsigned> counts;
+        std::vector<unsigned> range_max;    // scratch, the busiest cell of each range of cells
+        unsigned max_count = 0;
+        std::vector<Color> pixels;
+        Color colormap[256];
+        Texture2D texture = { 0 };
+
+    } DensityMap;
+
+    // roughly inferno, dark purple through red and orange to pale yellow, readable on the beige background
+    inline void BuildColormap(Color colormap[256])
+    {
+        const Color stops[] = {
+            { 0, 0, 4, 255 }, { 66, 10, 104, 255 }, { 147, 38, 103, 255 }, { 221, 81, 58, 255 }, { 252, 165, 10, 255 }, { 252, 255, 164, 255 }
+        };
+        const int segments = sizeof(stops) / sizeof(stops[0]) - 1;
+
+        for (int i = 0; i < 256; ++i)
+        {
+            const float t = i / 255.0f * segments;
+            const int s = std::min((int)t, segments - 1);
+            const float f = t - s;
+
+            colormap[i] = Color{ (unsigned char)(stops[s].r + (stops[s + 1].r - stops[s].r) * f),
+                                 (unsigned char)(stops[s].g + (stops[s + 1].g - stops[s].g) * f),
+                                 (unsigned char)(stops[s].b + (stops[s + 1].b - stops[s].b) * f), 255 };
+        }
+
+        // empty cells are see through
+        colormap[0].a = 0;
+    }
+
+    // cells of cell_size world units covering [world_min, world_max], the texture needs a window
+    inline void LoadDensityMap(DensityMap& map, const Vector2& world_min, const Vector2& world_max, float cell_size)
+    {
+        map.world_min = world_min;
+        map.world_max = world_max;
+        map.width = std::max(1, (int)ceilf((world_max.x - world_min.x) / cell_size));
+        map.height = std::max(1, (int)ceilf((world_max.y - world_min.y) / cell_size));
+        map.counts.assign(map.width * map.height, 0);
+        map.pixels.assign(map.width * map.height, BLANK);
+        BuildColormap(map.colormap);
+
+        Image image = { map.pixels.data(), map.width, map.height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        map.texture = LoadTextureFromImage(image);
+        SetTextureFilter(map.texture, TEXTURE_FILTER_BILINEAR);
+    }
+
+    inline void UnloadDensityMap(DensityMap& map)
+    {
+        UnloadTexture(map.texture);
+    }
+
+    // the histogram and the colours, no GL in here so it can run anywhere
+    template <typename Ball>
+    void BinDensity(DensityMap& map, const std::vector<Ball>& balls)
+    {
+        const int cells = map.width * map.height;
+        const int n = balls.size();
+        const float sx = map.width / (map.world_max.x - map.world_min.x);
+        const float sy = map.height / (map.world_max.y - map.world_min.y);
+
+        // every chunk of balls bins into its own histogram like Parallel::Collect() gives every chunk
+        // its own buffer, nothing shared so nothing atomic and nothing that depends on which thread
+        // runs it. A chunk per thread is enough since every histogram costs a pass over the cells
+        const int chunks = std::max(1, std::min(Parallel::ThreadCount(), n / 4096));
+        if (map.chunk_counts.size() < chunks)
+        {
+            map.chunk_counts.resize(chunks);
+        }
+
+        Parallel::For(0, chunks, [&](int c_begin, int c_end, int)
+        {
+            for (int c = c_begin; c < c_end; ++c)
+            {
+                std::vector<unsigned>& counts = map.chunk_counts[c];
+                counts.assign(cells, 0);
+
+                const int stop = (int)((long)n * (c + 1) / chunks);
+                for (int i = (int)((long)n * c / chunks); i < stop; ++i)
+                {
+                    const int x = std::clamp((int)((balls[i].position.x - map.world_min.x) * sx), 0, map.width - 1);
+                    const int y = std::clamp((int)((balls[i].position.y - map.world_min.y) * sy), 0, map.height - 1);
+                    ++counts[y * map.width + x];
+                }
+            }
+        }, 1);
+
+        // then ranges of cells are summed across the histograms, every range keeping its own busiest cell
+        const int ranges = std::max(1, std::min(Parallel::ThreadCount() * 4, cells / 4096));
+        map.range_max.assign(ranges, 0);
+        Parallel::For(0, ranges, [&](int r_begin, int r_end, int)
+        {
+            for (int r = r_begin; r < r_end; ++r)
+            {
+                const int stop = (int)((long)cells * (r + 1) / ranges);
+                for (int cell = (int)((long)cells * r / ranges); cell < stop; ++cell)
+                {
+                    unsigned sum = 0;
+                    for (int c = 0; c < chunks; ++c)
+                    {
+                        sum += map.chunk_counts[c][cell];
+                    }
+                    map.counts[cell] = sum;
+                    map.range_max[r] = std::max(map.range_max[r], sum);
+                }
+            }
+        }, 1);
+
+        map.max_count = *std::max_element(map.range_max.begin(), map.range_max.end());
+
+        // log scale, otherwise one crowded corner turns everything else black
+        const float scale = map.max_count > 0 ? 255.0f / logf(1.0f + map.max_count) : 0.0f;
+        Parallel::For(0, cells, [&](int start, int stop, int)
+        {
+            for (int c = start; c < stop; ++c)
+            {
+                const int level = map.counts[c] == 0 ? 0 : std::max(1, (int)(logf(1.0f + map.counts[c]) * scale));
+                map.pixels[c] = map.colormap[std::min(level, 255)];
+            }
+        }, 4096);
+    }
+
+    inline void UploadDensityMap(DensityMap& map)
+    {
+        UpdateTexture(map.texture, map.pixels.data());
+    }
+
+    // stretched over the area it covers, call inside BeginMode2D() like the balls
+    inline void DrawDensityMap(const DensityMap& map)
+    {
+        const ::Rectangle source = { 0.0f, 0.0f, (float)map.width, (float)map.height };
+        const ::Rectangle dest = { map.world_min.x, map.world_min.y, map.world_max.x - map.world_min.x, map.world_max.y - map.world_min.y };
+        DrawTexturePro(map.texture, source, dest, Vector2{ 0.0f, 0.0f }, 0.0f, WHITE);
+    }
+};
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef DIMENSION_H
+#define DIMENSION_H
+
+#include "defs.h"
+
+// lets the physics be written once for both 2D balls (Raylib::Circle) and 3D balls (Raylib::Sphere),
+// Dimension<D> says which shape and vector type a D dimensional simulation uses and the little
+// overloads below paper over the two structs naming their fields differently
+
+namespace Physics
+{
+    template <int D>
+    struct Dimension;
+
+    template <>
+    struct Dimension<2>
+    {
+        typedef Raylib::Circle Body;
+        typedef Vector2 Vec;
+    };
+
+    template <>
+    struct Dimension<3>
+    {
+        typedef Raylib::Sphere Body;
+        typedef Vector3 Vec;
+    };
+
+    inline Vector2& Position(Raylib::Circle& ball) { return ball.position; }
+    inline const Vector2& Position(const Raylib::Circle& ball) { return ball.position; }
+    inline Vector3& Position(Raylib::Sphere& ball) { return ball.centerPos; }
+    inline const Vector3& Position(const Raylib::Sphere& ball) { return ball.centerPos; }
+
+    // a ball's mass is its area in 2D and its volume in 3D (density 1), big balls pull harder
+    inline float BallMass(const Raylib::Circle& ball) { return ball.radius * ball.radius; }
+    inline float BallMass(const Raylib::Sphere& ball) { return ball.radius * ball.radius * ball.radius; }
+
+    // the vector structs are just packed floats, so index them like arrays for loops over the axes
+    inline float& Component(Vector2& v, int axis) { return (&v.x)[axis]; }
+    inline float Component(const Vector2& v, int axis) { return (&v.x)[axis]; }
+    inline float& Component(Vector3& v, int axis) { return (&v.x)[axis]; }
+    inline float Component(const Vector3& v, int axis) { return (&v.x)[axis]; }
+
+    inline float Dot(const Vector2& a, const Vector2& b) { return a.x * b.x + a.y * b.y; }
+    inline float Dot(const Vector3& a, const Vector3& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+    // config values are stored as Vector3, 2D just drops z
+    template <typename Vec> Vec FromVector3(const Vector3& v);
+    template <> inline Vector2 FromVector3<Vector2>(const Vector3& v) { return Vector2{ v.x, v.y }; }
+    template <> inline Vector3 FromVector3<Vector3>(const Vector3& v) { return v; }
+
+    // direction a vortex pushes at offset d from its centre, around z in 2D and around the up (y) axis in 3D
+    inline Vector2 Swirl(const Vector2& d) { return Vector2{ -d.y, d.x }; }
+    inline Vector3 Swirl(const Vector3& d) { return Vector3{ d.z, 0.0f, -d.x }; }
+};
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef FORCES_H
+#define FORCES_H
+
+#include "defs.h"
+#include "dimension.h"
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <cmath>
+
+// force fields that act on every ball before it gets integrated, loaded from a
+// plain text config file so I can play with them without recompiling
+
+namespace Physics
+{
+    enum ForceType
+    {
+        FORCE_GRAVITY,          // constant acceleration
+        FORCE_LINEAR_DRAG,      // a = -k * v
+        FORCE_QUADRATIC_DRAG,   // a = -k * |v| * v
+        FORCE_ATTRACTOR,        // pulls towards a point, falls off with 1 / r^2
+        FORCE_VORTEX            // swirls around a point, falls off with 1 / r
+    };
+
+    // which stages a simulation step needs, every combination gets its own compiled kernel
+    enum Feature
+    {
+        FEATURE_COLLISIONS = 1 << 0,    // ball vs ball
+        FEATURE_GRAVITY = 1 << 1,       // uniform gravity
+        FEATURE_DRAG = 1 << 2,          // linear and quadratic drag
+        FEATURE_FIELDS = 1 << 3,        // attractors and vortices
+        FEATURE_ALL = (1 << 4) - 1
+    };
+
+    typedef struct ForceField
+    {
+        ForceType type;
+        Vector3 vec;            // acceleration for gravity, centre point for attractors and vortices (2D ignores z)
+        float strength;         // drag coefficient or attractor / vortex strength
+        float softening;        // stops attractors and vortices blowing up right at their centre
+
+    } ForceField;
+
+    // the fields boiled down to what the kernels actually loop over
+    typedef struct ForceSet
+    {
+        Vector3 gravity = { 0.0f, 0.0f, 0.0f };     // every gravity field summed
+        float linear_drag = 0.0f;
+        float quadratic_drag = 0.0f;
+        std::vector<ForceField> attractors;
+        std::vector<ForceField> vortices;
+
+    } ForceSet;
+
+    // balls pulling on each other, this isn't a field so it gets its own settings
+    typedef struct NBodySettings
+    {
+        bool enabled = false;
+        bool brute_force = false;   // O(n^2) reference instead of the Barnes-Hut tree
+        float G = 0.0f;
+        float theta = 0.5f;         // Barnes-Hut opening angle, 0 is exact, bigger is faster and sloppier
+        float softening = 1.0f;
+
+    } NBodySettings;
+
+    // returns false for any line that isn't an nbody one, and for a broken one with error saying why
+    inline bool ParseNBodySettings(const std::string& line, NBodySettings& nbody, std::string* error = NULL)
+    {
+        std::istringstream in(line);
+        std::string name;
+
+        if (!(in >> name) || name != "nbody")
+        {
+            return false;
+        }
+        // read into a copy so a broken line leaves nbody as it was
+        NBodySettings parsed = nbody;
+        if (!(in >> parsed.G))
+        {
+            if (error != NULL)
+            {
+                *error = "couldn't read '" + line + "'";
+            }
+            return false;
+        }
+
+        std::string mode;
+        in >> parsed.theta >> parsed.softening >> mode;    // all optional
+
+        // two balls in the same spot (or a ball and itself in a leaf of the tree) would be 0 / 0
+        if (!(parsed.softening > 0.0f))
+        {
+            if (error != NULL)
+            {
+                *error = "nbody softening has to be above 0 in '" + line + "'";
+            }
+            return false;
+        }
+
+        parsed.brute_force = (mode == "brute");
+        parsed.enabled = true;
+        nbody = parsed;
+        return true;
+    }
+
+    // parses one line of the config, returns false for comments, blank lines and junk. For junk
+    // error says what was wrong with it, and is left alone for anything that's fine to skip
+    inline bool ParseForceField(const std::string& line, ForceField& field, std::string* error = NULL)
+    {
+        std::istringstream in(line);
+        std::string name;
+
+        if (!(in >> name) || name[0] == '#')
+        {
+            return false;
+        }
+
+        field.vec = Vector3{ 0.0f, 0.0f, 0.0f };
+        field.strength = 0.0f;
+        field.softening = 1.0f;
+
+        bool read = false;
+
+        if (name == "gravity")
+        {
+            field.type = FORCE_GRAVITY;
+            read = (bool)(in >> field.vec.x >> field.vec.y);
+            in >> field.vec.z;          // optional, only 3D uses it
+        }
+        else if (name == "drag_linear")
+        {
+            field.type = FORCE_LINEAR_DRAG;
+            read = (bool)(in >> field.strength);
+        }
+        else if (name == "drag_quadratic")
+        {
+            field.type = FORCE_QUADRATIC_DRAG;
+            read = (bool)(in >> field.strength);
+        }
+        else if (name == "nbody")
+        {
+            return false;       // handled by ParseNBodySettings
+        }
+        else if (name == "attractor" || name == "vortex")
+        {
+            field.type = (name == "attractor") ? FORCE_ATTRACTOR : FORCE_VORTEX;
+            read = (bool)(in >> field.vec.x >> field.vec.y >> field.strength);
+            in >> field.softening;      // optional
+        }
+        else if (name == "attractor3" || name == "vortex3")
+        {
+            field.type = (name == "attractor3") ? FORCE_ATTRACTOR : FORCE_VORTEX;
+            read = (bool)(in >> field.vec.x >> field.vec.y >> field.vec.z >> field.strength);
+            in >> field.softening;      // optional
+        }
+        else
+        {
+            if (error != NULL)
+            {
+                *error = "unknown force field '" + name + "'";
+            }
+            return false;
+        }
+
+        if (!read && error != NULL)
+        {
+            *error = "couldn't read '" + line + "'";
+        }
+        return read;
+    }
+
+    // loads every force field in the file, a missing file just means no forces. Lines that
+    // couldn't be read are skipped and what was wrong with them goes in errors for the caller to report
+    inline int LoadForceFields(const std::string& path, std::vector<ForceField>& fields, NBodySettings& nbody, std::vector<std::string>& errors)
+    {
+        std::ifstream file(path);
+        std::string line;
+        int loaded = 0;
+
+        for (int number = 1; std::getline(file, line); ++number)
+        {
+            ForceField field;
+            std::string error;
+            if (ParseNBodySettings(line, nbody, &error))
+            {
+                ++loaded;
+            }
+            else if (error.empty() && ParseForceField(line, field, &error))
+            {
+                fields.push_back(field);
+                ++loaded;
+            }
+
+            if (!error.empty())
+            {
+                errors.push_back(path + ":" + std::to_string(number) + ": " + error);
+            }
+        }
+
+        return loaded;
+    }
+
+    inline ForceSet BuildForceSet(const std::vector<ForceField>& fields)
+    {
+        ForceSet set;
+
+        for (int f = 0; f < fields.size(); ++f)
+        {
+            switch (fields[f].type)
+            {
+                case FORCE_GRAVITY:         set.gravity = set.gravity + fields[f].vec; break;
+                case FORCE_LINEAR_DRAG:     set.linear_drag += fields[f].strength; break;
+                case FORCE_QUADRATIC_DRAG:  set.quadratic_drag += fields[f].strength; break;
+                case FORCE_ATTRACTOR:       set.attractors.push_back(fields[f]); break;
+                case FORCE_VORTEX:          set.vortices.push_back(fields[f]); break;
+            }
+        }
+
+        return set;
+    }
+
+    // which of the force features a set actually uses, collisions are up to the caller
+    inline unsigned ForceFeatures(const ForceSet& set)
+    {
+        unsigned features = 0;
+
+        if (set.gravity.x != 0.0f || set.gravity.y != 0.0f || set.gravity.z != 0.0f)
+        {
+            features |= FEATURE_GRAVITY;
+        }
+        if (set.linear_drag != 0.0f || set.quadratic_drag != 0.0f)
+        {
+            features |= FEATURE_DRAG;
+        }
+        if (!set.attractors.empty() || !set.vortices.empty())
+        {
+            features |= FEATURE_FIELDS;
+        }
+
+        return features;
+    }
+
+    // one pass over all the balls per stage, the stages a kernel doesn't have are compiled out
+    // and each loop is branch free so the compiler can vectorize it, accel is left holding the
+    // total acceleration of each ball
+    template <unsigned Features, typename Body, typename Vec>
+    void ComputeAccelerations(const ForceSet& forces, const std::vector<Body>& balls, std::vector<Vec>& accel)
+    {
+        const int n = balls.size();
+        const Vec gravity = (Features & FEATURE_GRAVITY) ? FromVector3<Vec>(forces.gravity) : Vec{};
+
+        accel.resize(n);
+        for (int i = 0; i < n; ++i)
+        {
+            accel[i] = gravity;
+        }
+
+        if constexpr ((Features & FEATURE_DRAG) != 0)
+        {
+            const float k1 = forces.linear_drag;
+            const float k2 = forces.quadratic_drag;
+
+            for (int i = 0; i < n; ++i)
+            {
+                const Vec& v = balls[i].velocity;
+                accel[i] = accel[i] - v * (k1 + k2 * sqrtf(Dot(v, v)));
+            }
+        }
+
+        if constexpr ((Features & FEATURE_FIELDS) != 0)
+        {
+            for (int f = 0; f < forces.attractors.size(); ++f)
+            {
+                const Vec center = FromVector3<Vec>(forces.attractors[f].vec);
+                const float k = forces.attractors[f].strength;
+                const float soft2 = forces.attractors[f].softening * forces.attractors[f].softening;
+
+                for (int i = 0; i < n; ++i)
+                {
+                    Vec d = center - Position(balls[i]);
+                    float r2 = Dot(d, d) + soft2;
+                    accel[i] = accel[i] + d * (k / (r2 * sqrtf(r2)));
+                }
+            }
+
+            for (int f = 0; f < forces.vortices.size(); ++f)
+            {
+                const Vec center = FromVector3<Vec>(forces.vortices[f].vec);
+                const float k = forces.vortices[f].strength;
+                const float soft2 = forces.vortices[f].softening * forces.vortices[f].softening;
+
+                for (int i = 0; i < n; ++i)
+                {
+                    Vec swirl = Swirl(Position(balls[i]) - center);
+                    accel[i] = accel[i] + swirl * (k / (Dot(swirl, swirl) + soft2));
+                }
+            }
+        }
+    }
+
+    // potential energy per unit mass at pos, only the conservative fields (gravity and attractors) count,
+    // drag and vortices pump energy in or out so they have no potential
+    template <typename Vec>
+    float ForceFieldPotential(const ForceSet& forces, const Vec& pos)
+    {
+        float potential = -Dot(FromVector3<Vec>(forces.gravity), pos);
+
+        for (int f = 0; f < forces.attractors.size(); ++f)
+        {
+            Vec d = pos - FromVector3<Vec>(forces.attractors[f].vec);
+            potential -= forces.attractors[f].strength / sqrtf(Dot(d, d) + forces.attractors[f].softening * forces.attractors[f].softening);
+        }
+
+        return potential;
+    }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef HANDLES_H
+#define HANDLES_H
+
+#include <vector>
+
+// stable names for balls. The ball arrays stay dense for the hot loops, so a ball's index changes
+// whenever another one is swap removed (pool.h) or the arrays get reordered, which makes indices
+// useless for holding on to a ball. A handle is a slot in a sparse table that points at wherever
+// the ball is now, plus the slot's generation, which goes up every time the slot is freed so a
+// handle to a ball that's gone never finds whatever reused its slot
+
+namespace Physics
+{
+    typedef struct BallHandle
+    {
+        int slot = -1;
+        unsigned generation = 0;
+
+    } BallHandle;
+
+    typedef struct HandleTable
+    {
+        std::vector<int> dense_of;              // slot -> ball index, -1 while the slot is free
+        std::vector<unsigned> generation;       // per slot
+        std::vector<int> slot_of;               // ball index -> slot, runs parallel to the balls
+        std::vector<int> free_slots;
+
+    } HandleTable;
+
+    // gives ball i (the next one past the end of slot_of) a slot
+    inline BallHandle CreateHandle(HandleTable& table, const int i)
+    {
+        int slot;
+        if (!table.free_slots.empty())
+        {
+            slot = table.free_slots.back();
+            table.free_slots.pop_back();
+        }
+        else
+        {
+            slot = table.dense_of.size();
+            table.dense_of.push_back(-1);
+            table.generation.push_back(0);
+        }
+
+        table.dense_of[slot] = i;
+        table.slot_of.push_back(slot);
+        return BallHandle{ slot, table.generation[slot] };
+    }
+
+    // ball i is going and the last ball is about to be moved into its slot, same as GridSwapRemove()
+    inline void SwapRemoveHandle(HandleTable& table, const int i)
+    {
+        const int last = table.slot_of.size() - 1;
+        const int slot = table.slot_of[i];
+
+        table.dense_of[slot] = -1;
+        ++table.generation[slot];
+        table.free_slots.push_back(slot);
+
+        if (i != last)
+        {
+            table.slot_of[i] = table.slot_of[last];
+            table.dense_of[table.slot_of[i]] = i;
+        }
+        table.slot_of.pop_back();
+    }
+
+    // catches the table up with balls that were pushed or popped straight off the end of the array
+    // (CreateBalls() and friends don't know about handles), so it covers balls [0, n)
+    inline void SyncHandles(HandleTable& table, const int n)
+    {
+        while (table.slot_of.size() > n)
+        {
+            SwapRemoveHandle(table, table.slot_of.size() - 1);
+        }
+        while (table.slot_of.size() < n)
+        {
+            CreateHandle(table, table.slot_of.size());
+        }
+    }
+
+    // the balls were put in a new order, order[i] is where ball i used to be
+    inline void ReorderHandles(HandleTable& table, const std::vector<int>& order, std::vector<int>& temp)
+    {
+        temp.resize(order.size());
+        for (int i = 0; i < order.size(); ++i)
+        {
+            temp[i] = table.slot_of[order[i]];
+            table.dense_of[temp[i]] = i;
+        }
+        table.slot_of.swap(temp);
+    }
+
+    inline BallHandle HandleOf(const HandleTable& table, const int i)
+    {
+        const int slot = table.slot_of[i];
+        return BallHandle{ slot, table.generation[slot] };
+    }
+
+    // where the ball is now, -1 if it's been removed (or the handle never pointed at anything)
+    inline int ResolveHandle(const HandleTable& table, const BallHandle& handle)
+    {
+        if (handle.slot < 0 || handle.slot >= table.dense_of.size() || table.generation[handle.slot] != handle.generation)
+        {
+            return -1;
+        }
+        return table.dense_of[handle.slot];
+    }
+};
+
+#endif
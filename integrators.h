@@ -0,0 +1,157 @@
+#ifndef INTEGRATORS_H
+#define INTEGRATORS_H
+
+#include "defs.h"
+#include "dimension.h"
+
+#include <vector>
+
+// the integrators are picked at compile time, Update() is a template over one of these
+// so the hot loop is a plain function call with nothing virtual in it
+//
+// every integrator has the same shape:
+//   static const char* name;
+//   template <typename Body, typename AccelFn> static void Step(float dt, std::vector<Body>& balls, AccelFn& accel_fn, IntegratorState<Body>& state);
+// where accel_fn(balls, accel) fills accel with the acceleration of every ball, Body is a Circle or a Sphere
+
+namespace Physics
+{
+    // scratch buffers kept between steps so integrating never allocates once it's warmed up
+    template <typename Body>
+    struct IntegratorState
+    {
+        typedef decltype(Body::velocity) Vec;
+
+        std::vector<Vec> accel;
+        std::vector<Vec> k_pos[4], k_vel[4];        // RK4 stages
+        std::vector<Body> temp;
+        bool accel_valid = false;                   // Verlet reuses the acceleration from the end of the last step
+    };
+
+    // x += v dt, v += a dt, the textbook one, gains energy and isn't stable for orbits
+    typedef struct ExplicitEuler
+    {
+        static constexpr const char* name = "euler";
+
+        template <typename Body, typename AccelFn>
+        static void Step(float dt, std::vector<Body>& balls, AccelFn& accel_fn, IntegratorState<Body>& state)
+        {
+            accel_fn(balls, state.accel);
+
+            for (int i = 0; i < balls.size(); ++i)
+            {
+                Position(balls[i]) = Position(balls[i]) + balls[i].velocity * dt;
+                balls[i].velocity = balls[i].velocity + state.accel[i] * dt;
+            }
+            state.accel_valid = false;
+        }
+
+    } ExplicitEuler;
+
+    // v += a dt then x += v dt, same cost as Euler but symplectic so energy stays bounded
+    typedef struct SemiImplicitEuler
+    {
+        static constexpr const char* name = "semi-implicit";
+
+        template <typename Body, typename AccelFn>
+        static void Step(float dt, std::vector<Body>& balls, AccelFn& accel_fn, IntegratorState<Body>& state)
+        {
+            accel_fn(balls, state.accel);
+
+            for (int i = 0; i < balls.size(); ++i)
+            {
+                balls[i].velocity = balls[i].velocity + state.accel[i] * dt;
+                Position(balls[i]) = Position(balls[i]) + balls[i].velocity * dt;
+            }
+            state.accel_valid = false;
+        }
+
+    } SemiImplicitEuler;
+
+    // second order and symplectic, one force evaluation per step because the acceleration at
+    // the end of a step is the one at the start of the next
+    typedef struct VelocityVerlet
+    {
+        static constexpr const char* name = "verlet";
+
+        template <typename Body, typename AccelFn>
+        static void Step(float dt, std::vector<Body>& balls, AccelFn& accel_fn, IntegratorState<Body>& state)
+        {
+            const int n = balls.size();
+
+            if (!state.accel_valid || state.accel.size() != n)
+            {
+                accel_fn(balls, state.accel);
+            }
+
+            // drift with the old acceleration, and guess the end velocity for velocity dependent forces (drag)
+            for (int i = 0; i < n; ++i)
+            {
+                Position(balls[i]) = Position(balls[i]) + balls[i].velocity * dt + state.accel[i] * (0.5f * dt * dt);
+                balls[i].velocity = balls[i].velocity + state.accel[i] * (0.5f * dt);
+            }
+
+            state.k_vel[0].swap(state.accel);
+            state.temp = balls;
+            for (int i = 0; i < n; ++i)
+            {
+                state.temp[i].velocity = state.temp[i].velocity + state.k_vel[0][i] * (0.5f * dt);
+            }
+
+            accel_fn(state.temp, state.accel);
+
+            for (int i = 0; i < n; ++i)
+            {
+                balls[i].velocity = balls[i].velocity + state.accel[i] * (0.5f * dt);
+            }
+            state.accel_valid = true;
+        }
+
+    } VelocityVerlet;
+
+    // classic 4th order Runge-Kutta, very accurate per step but 4 force evaluations
+    typedef struct RK4
+    {
+        static constexpr const char* name = "rk4";
+
+        template <typename Body, typename AccelFn>
+        static void Step(float dt, std::vector<Body>& balls, AccelFn& accel_fn, IntegratorState<Body>& state)
+        {
+            const int n = balls.size();
+            const float offsets[4] = { 0.0f, 0.5f * dt, 0.5f * dt, dt };
+
+            state.temp = balls;
+
+            for (int k = 0; k < 4; ++k)
+            {
+                // evaluate stage k at the state nudged along the previous stage's slope
+                if (k > 0)
+                {
+                    for (int i = 0; i < n; ++i)
+                    {
+                        Position(state.temp[i]) = Position(balls[i]) + state.k_pos[k - 1][i] * offsets[k];
+                        state.temp[i].velocity = balls[i].velocity + state.k_vel[k - 1][i] * offsets[k];
+                    }
+                }
+
+                state.k_pos[k].resize(n);
+                for (int i = 0; i < n; ++i)
+                {
+                    state.k_pos[k][i] = state.temp[i].velocity;
+                }
+                accel_fn(state.temp, state.k_vel[k]);
+            }
+
+            const float w = dt / 6.0f;
+            for (int i = 0; i < n; ++i)
+            {
+                Position(balls[i]) = Position(balls[i]) + (state.k_pos[0][i] + (state.k_pos[1][i] + state.k_pos[2][i]) * 2.0f + state.k_pos[3][i]) * w;
+                balls[i].velocity = balls[i].velocity + (state.k_vel[0][i] + (state.k_vel[1][i] + state.k_vel[2][i]) * 2.0f + state.k_vel[3][i]) * w;
+            }
+            state.accel_valid = false;
+        }
+
+    } RK4;
+};
+
+#endif
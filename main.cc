@@ -1,106 +1,638 @@
 #include "defs.h"
+#include "simulation.h"
+#include "parallel.h"
+#include "memory.h"
+#include "render3d.h"
+#include "canvas.h"
+#include "softraster.h"
+#include "capture.h"
+#include "render2d.h"
+#include "config.h"
+#include "panel.h"
+#include "pool.h"
 
 #include <vector>
 #include <random>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 
-void CreateBalls(std::vector<Raylib::Circle>&, const int num_balls);
-void CreateWindowBarriers(std::vector<Raylib::Line>&);
-void Render(const float dt, std::vector<Raylib::Line>& vec, std::vector<Raylib::Circle>& balls);
-void Update(const float dt, std::vector<Raylib::Circle>& balls, std::vector<Raylib::Line>& lines);
+void GetBallColors(std::vector<Color>& colors, const Config::SimConfig& config);
+void CreateBalls(std::vector<Raylib::Circle>&, const Config::SimConfig& config, const unsigned seed);
+Raylib::Circle RandomBall(const Config::SimConfig& config, const std::vector<Color>& colors, std::mt19937& gen);
+Raylib::Circle SpawnBall(const Config::SimConfig& config, const std::vector<Color>& colors, const Physics::Spawner& spawner, std::mt19937& gen);
+void AdjustBallCount(Physics::Simulation<2>& sim, const Config::SimConfig& config, const float dt, int& remaining, float& budget, std::mt19937& gen);
+void CreateWindowBarriers(std::vector<Raylib::Line>&, const int width, const int height);
+Physics::StepFunction<2> SetupSimulation(Physics::Simulation<2>& sim, const Config::SimConfig& config, const unsigned seed);
+void MoveCamera2D(Camera2D& camera);
+template <typename Canvas>
+void DrawScene(Canvas& canvas, std::vector<Raylib::Line>& vec, const std::vector<Raylib::Circle>& balls);
+int RunHeadless(const Config::SimConfig& config);
+void Update(const float dt, Physics::Simulation<2>& sim, const Physics::StepFunction<2> step);
 
-int main(void)
+// what the simulation thread hands the render thread after every step
+typedef struct Snapshot
 {
-    const int window_height = 512;
-    const int window_width = 512;
+    std::vector<Raylib::Circle> balls;
+    Physics::StepTimings timings;
+    long step;
+    Physics::BallHandle selected;       // shift click picks a ball, it's followed by handle
+    int selected_index = -1;            // where it is in balls, -1 if it's gone
+
+} Snapshot;
+
+bool Render(const float dt, std::vector<Raylib::Line>& vec, const Snapshot& snapshot, Graphics::ScreenCanvas& screen, Graphics::Capture& capture,
+            Graphics::ControlPanel& panel, Config::SimConfig& config, const Memory::FrameMemory& memory);
+void DrawMemoryOverlay(const Memory::FrameMemory& memory, const int x, int y);
+
+// settings changed while running (a config reload or the side panel), the simulation thread swaps them in between two steps
+typedef struct LiveSettings
+{
+    std::mutex mutex;
+    std::atomic<bool> pending{ false };
+    Config::SimConfig config;
+    Physics::ForceSet forces;
+    Physics::NBodySettings nbody;
+    Physics::StepFunction<2> step;      // the forces and the integrator decide which kernel
+
+    // holding the left mouse button spawns balls under it, shift clicking selects one, in world units
+    std::atomic<bool> mouse_down{ false };
+    std::atomic<bool> select_clicked{ false };
+    std::atomic<float> mouse_x{ 0.0f }, mouse_y{ 0.0f };
+
+} LiveSettings;
+
+void SimulationThread(Physics::Simulation<2>& sim, Parallel::TripleBuffer<Snapshot>& snapshots, LiveSettings& live, std::atomic<bool>& running);
+void LoadLiveForces(const Config::SimConfig& config, LiveSettings& live);
+void ApplyLiveSettings(const Config::SimConfig& config, LiveSettings& live, Graphics::ScreenCanvas& screen, Graphics::DensityMap& density_map);
+Physics::StepFunction<2> SelectStep(const Config::SimConfig& config, const Physics::ForceSet& forces);
+
+int Run3D(const Config::SimConfig& config);
+void CreateSpheres(std::vector<Raylib::Sphere>& spheres, const Config::SimConfig& config, const float box_half);
+void Render3D(Raylib::Camera& camera, Raylib::Cube& box, Graphics::CubeRenderer& cube_renderer, Graphics::SphereRenderer& sphere_renderer, std::vector<Raylib::Sphere>& spheres);
+
+int main(int argc, char** argv)
+{
+    // sim.cfg (or --config <path>) then the rest of the command line, see sim.cfg for the keys
+    Config::SimConfig config;
+    if (!Config::LoadConfig(argc, argv, config))
+    {
+        return 1;
+    }
+
+    // '--mode 3d' (or just '3d') bounces spheres around a box instead
+    if (config.mode_3d)
+    {
+        return Run3D(config);
+    }
+
+    // '--headless' runs without a window and saves the last frame from the software rasterizer,
+    // '--golden reference.png' does the same and pixel diffs it against a reference ('--bless' writes it instead)
+    if (config.headless)
+    {
+        return RunHeadless(config);
+    }
+
     const std::string window_name = "Bouncy Balls";
     float delta_time;
     float time;         // for shaders
 
-    InitWindow(window_width, window_height, window_name.c_str());
-    SetTargetFPS(120);
+    InitWindow(config.width, config.height, window_name.c_str());
+    SetTargetFPS(config.fps);
     SetExitKey(KEY_Q);
+    Graphics::SetMeshCacheBudget(Graphics::mesh_cache, config.mesh_cache_mb * (1 << 20));
 
     // create 4 lines to act as the screen barriers
     std::vector<Raylib::Line> window_barriers;
 
-    CreateWindowBarriers(window_barriers);
+    CreateWindowBarriers(window_barriers, GetScreenWidth(), GetScreenHeight());
 
-    // create bouncing balls
-    std::vector<Raylib::Circle> balls;
+    // create bouncing balls, the window edges are the walls
+    Physics::Simulation<2> sim;
+    const Physics::StepFunction<2> step = SetupSimulation(sim, config, config.seed != 0 ? config.seed : std::random_device()());
+    if (step == NULL)
+    {
+        CloseWindow();
+        return 1;
+    }
+
+    // physics runs on its own thread from here on, the window only ever draws the newest snapshot
+    // it published, so a slow step doesn't drop frames and waiting on vsync doesn't slow the physics
+    Parallel::TripleBuffer<Snapshot> snapshots;
+    Parallel::WriteBuffer(snapshots).balls = sim.balls;
+    Parallel::Publish(snapshots);
+
+    // '--record out.y4m' (or out.raw, or a directory for a png sequence) captures every frame to disk
+    Graphics::Capture capture;
+    if (!config.record.empty())
+    {
+        Graphics::StartCapture(capture, config.record, GetScreenWidth(), GetScreenHeight(), config.fps, true);
+    }
 
-    CreateBalls(balls, 50);
+    // balls go through the level of detail batch, the camera zooms with the mouse wheel and pans with the right button
+    Graphics::CircleRenderer circle_renderer;
+    Graphics::LoadCircleRenderer(circle_renderer);
+
+    Graphics::ScreenCanvas screen;
+    screen.circles = &circle_renderer;
+
+    // M swaps the balls for a heat map of where they are, which it starts on when asked to or when there are too many to draw one by one
+    Graphics::DensityMap density_map;
+    Graphics::LoadDensityMap(density_map, sim.bounds_min, sim.bounds_max, 4.0f);
+    config.render = sim.balls.size() > 100000 ? "density" : config.render;
+    screen.density = config.render == "density" ? &density_map : NULL;
+
+    // editing the config or forces file while this runs, or using the side panel, changes the simulation without restarting it
+    Config::ConfigWatcher watcher;
+    Config::StartConfigWatcher(watcher, config);
+
+    Graphics::ControlPanel panel;
+    Graphics::SyncControlPanel(panel, config, Parallel::ThreadCount());
+
+    LiveSettings live;
+    live.config = config;
+    live.forces = sim.forces;
+    live.nbody = sim.nbody;
+    live.step = step;
+    live.pending = true;
+
+    std::atomic<bool> running(true);
+    std::thread sim_thread(SimulationThread, std::ref(sim), std::ref(snapshots), std::ref(live), std::ref(running));
+
+    // what every frame allocated, by subsystem, for the panel
+    Memory::FrameMemory frame_memory;
 
     while(!WindowShouldClose())
     {
         delta_time = GetFrameTime();
         time = GetTime();
 
-        Update(delta_time, balls, window_barriers);
+        Parallel::Acquire(snapshots);
+
+        MoveCamera2D(screen.camera);
 
-        Render(delta_time, window_barriers, balls);
+        const bool shift = IsKeyDown(KEY_LEFT_SHIFT) || IsKeyDown(KEY_RIGHT_SHIFT);
+        live.mouse_down = IsMouseButtonDown(MOUSE_BUTTON_LEFT) && !shift && !Graphics::PanelContainsMouse(panel);
+        live.select_clicked = live.select_clicked || (IsMouseButtonPressed(MOUSE_BUTTON_LEFT) && shift && !Graphics::PanelContainsMouse(panel));
+        if (live.mouse_down || live.select_clicked)
+        {
+            const Vector2 mouse = GetScreenToWorld2D(GetMousePosition(), screen.camera);
+            live.mouse_x = mouse.x;
+            live.mouse_y = mouse.y;
+        }
+        if (IsKeyPressed(KEY_M))
+        {
+            config.render = screen.density ? "balls" : "density";
+            ApplyLiveSettings(config, live, screen, density_map);
+            Graphics::SyncControlPanel(panel, config, Parallel::ThreadCount());
+        }
+
+        if (Config::ConfigChanged(watcher) && Config::ReloadConfig(config))
+        {
+            LoadLiveForces(config, live);
+            ApplyLiveSettings(config, live, screen, density_map);
+            Graphics::SyncControlPanel(panel, config, Parallel::ThreadCount());
+            std::cout << "reloaded " << config.path << ", " << Parallel::ThreadCount() << " threads" << std::endl;
+        }
+
+        bool changed;
+        {
+            Memory::MemoryScope memory(Memory::MEM_RENDER);
+            changed = Render(delta_time, window_barriers, Parallel::ReadBuffer(snapshots), screen, capture, panel, config, frame_memory);
+        }
+        if (changed)
+        {
+            ApplyLiveSettings(config, live, screen, density_map);
+        }
+
+        Memory::EndFrame(frame_memory);
     }
 
+    running = false;
+    sim_thread.join();
+
+    Config::StopConfigWatcher(watcher);
+
+    Graphics::StopCapture(capture);
+
+    Graphics::UnloadCircleRenderer(circle_renderer);
+    Graphics::UnloadDensityMap(density_map);
+    Graphics::UnloadMeshCache(Graphics::mesh_cache);
     CloseWindow();
 
     return 0;
 }
 
-void Render(const float dt, std::vector<Raylib::Line>& vec, std::vector<Raylib::Circle>& balls)
+// returns true if the side panel changed the config
+bool Render(const float dt, std::vector<Raylib::Line>& vec, const Snapshot& snapshot, Graphics::ScreenCanvas& screen, Graphics::Capture& capture,
+            Graphics::ControlPanel& panel, Config::SimConfig& config, const Memory::FrameMemory& memory)
 {
-    BeginDrawing();
+    const std::vector<Raylib::Circle>& balls = snapshot.balls;
 
-    ClearBackground(BEIGE);
+    // when recording, the scene goes to the capture texture first and that gets shown on screen
+    if (capture.active)
+    {
+        BeginTextureMode(capture.target);
+        DrawScene(screen, vec, balls);
+        EndTextureMode();
 
-    for (int i = 0; i < vec.size(); ++i)
+        Graphics::ReadbackCapture(capture);
+    }
+
+    BeginDrawing();
+
+    if (capture.active)
     {
-        vec[i].DrawLineFilled();
+        // render textures are upside down
+        DrawTextureRec(capture.target.texture, Rectangle{ 0, 0, (float)capture.width, -(float)capture.height }, Vector2{ 0, 0 }, WHITE);
+    }
+    else
+    {
+        DrawScene(screen, vec, balls);
     }
 
-    for (int i = 0; i < balls.size(); ++i)
+    // the selected ball gets a ring, wherever swap removes and reordering have moved it to
+    if (snapshot.selected_index >= 0)
     {
-        balls[i].DrawFilledCircle();
-        balls[i].DrawCircleOutline(BLACK);
+        const Raylib::Circle& ball = balls[snapshot.selected_index];
+        BeginMode2D(screen.camera);
+        DrawRing(ball.position, ball.radius + 2.0f / screen.camera.zoom, ball.radius + 4.0f / screen.camera.zoom, 0.0f, 360.0f, 32, RED);
+        EndMode2D();
+
+        DrawText(TextFormat("ball %i:%u at %.0f, %.0f moving %.0f", snapshot.selected.slot, snapshot.selected.generation, ball.position.x, ball.position.y,
+                            Vector2Length(ball.velocity)), 2, GetScreenHeight() - 28, 10, RED);
+    }
+    else if (snapshot.selected.slot >= 0)
+    {
+        DrawText(TextFormat("ball %i:%u is gone", snapshot.selected.slot, snapshot.selected.generation), 2, GetScreenHeight() - 28, 10, RED);
     }
 
     DrawFPS(2, 2);
 
-    std::string text = "Bouncy Ball Simulation";
-    DrawText(text.c_str(), GetScreenWidth() / 2 - 1.5 * GetTextWidth(text.c_str()), 15, 30, BLACK);
-    
+    if (screen.density != NULL)
+    {
+        DrawText(TextFormat("density, %i balls in the busiest cell", screen.density->max_count), 2, GetScreenHeight() - 14, 10, DARKGRAY);
+    }
+    else if (screen.circles != NULL)
+    {
+        const Graphics::CircleStats& stats = screen.circles->stats;
+        DrawText(TextFormat("%i tessellated, %i discs, %i culled, %i vertices", stats.drawn, stats.discs, stats.culled, stats.vertices), 2, GetScreenHeight() - 14, 10, DARKGRAY);
+    }
+
+    DrawMemoryOverlay(memory, 2, 22);
+
+    Graphics::DrawQueuedMeshes(Graphics::mesh_cache);     // anything queued in screen space
+
+    const bool changed = Graphics::DrawControlPanel(panel, config, snapshot.timings, snapshot.balls.size());
+
     EndDrawing();
+
+    return changed;
 }
 
-void Update(const float dt, std::vector<Raylib::Circle>& balls, std::vector<Raylib::Line>& lines)
+// what the last frame allocated and where, the resident set and how deep the task arena has got. A
+// line per subsystem that allocated anything, which once the ball count settles should be none
+void DrawMemoryOverlay(const Memory::FrameMemory& memory, const int x, int y)
 {
-    for (int i = 0; i < balls.size(); ++i)
+    long allocations = 0, bytes = 0;
+    for (int t = 0; t < Memory::MEM_TAG_COUNT; ++t)
     {
-        balls[i].position.x += balls[i].velocity.x * dt;
-        balls[i].position.y += balls[i].velocity.y * dt;
+        allocations += memory.last.allocations[t];
+        bytes += memory.last.bytes[t];
+    }
+
+    DrawText(TextFormat("heap %li allocs, %li bytes last frame (%li of %li frames allocated)", allocations, bytes, memory.allocating_frames, memory.frames),
+             x, y, 10, DARKGRAY);
+    DrawText(TextFormat("rss %.1f MB, peak %.1f MB, task arena peak %i", memory.rss_kb / 1024.0f, memory.peak_rss_kb / 1024.0f, Parallel::TaskArenaPeak()),
+             x, y + 12, 10, DARKGRAY);
+    y += 24;
 
-        // check for wall collisions
-        if ((balls[i].position.x >= (GetScreenWidth() - balls[i].radius)) || (balls[i].position.x <= balls[i].radius))
+    for (int t = 0; t < Memory::MEM_TAG_COUNT; ++t)
+    {
+        if (memory.last.allocations[t] > 0)
         {
-            balls[i].velocity.x *= -1.0f;
+            DrawText(TextFormat("  %s %li allocs, %li bytes, high water %.1f KB", Memory::tag_names[t], memory.last.allocations[t], memory.last.bytes[t],
+                                Memory::PeakLiveBytes(t) / 1024.0f), x, y, 10, MAROON);
+            y += 12;
         }
+    }
+}
+
+// mouse wheel zooms in on whatever is under the cursor, right drag pans, R puts it back
+void MoveCamera2D(Camera2D& camera)
+{
+    const float wheel = GetMouseWheelMove();
+    if (wheel != 0.0f)
+    {
+        const Vector2 mouse = GetMousePosition();
+        camera.target = GetScreenToWorld2D(mouse, camera);
+        camera.offset = mouse;
+        camera.zoom = Clamp(camera.zoom * powf(1.25f, wheel), 0.01f, 64.0f);
+    }
+
+    if (IsMouseButtonDown(MOUSE_BUTTON_RIGHT))
+    {
+        camera.target = Vector2Subtract(camera.target, Vector2Scale(GetMouseDelta(), 1.0f / camera.zoom));
+    }
+
+    if (IsKeyPressed(KEY_R))
+    {
+        camera = Camera2D{ { 0.0f, 0.0f }, { 0.0f, 0.0f }, 0.0f, 1.0f };
+    }
+}
+
+// everything in the 2D scene except the FPS counter, which would never match a golden image
+template <typename Canvas>
+void DrawScene(Canvas& canvas, std::vector<Raylib::Line>& vec, const std::vector<Raylib::Circle>& balls)
+{
+    CanvasClear(canvas, BEIGE);
+
+    CanvasBeginWorld(canvas);
+
+    for (int i = 0; i < vec.size(); ++i)
+    {
+        vec[i].DrawLineFilled(canvas);
+    }
+
+    CanvasBalls(canvas, balls, BLACK);
+
+    CanvasEndWorld(canvas);
+
+    std::string text = "Bouncy Ball Simulation";
+    CanvasText(canvas, text, CanvasWidth(canvas) / 2 - CanvasTextWidth(canvas, text, 30) / 2, 15, 30, BLACK);
+}
+
+// the balls, forces, threads and kernel from the config, shared by the window and headless runs.
+// NULL if the config names an integrator that doesn't exist
+Physics::StepFunction<2> SetupSimulation(Physics::Simulation<2>& sim, const Config::SimConfig& config, const unsigned seed)
+{
+    sim.bounds_min = Vector2{ 0.0f, 0.0f };
+    sim.bounds_max = Vector2{ (float)config.width, (float)config.height };
+    sim.broadphase = config.broadphase;
+    sim.restitution = config.restitution;
+    sim.order.every = config.reorder_every;
+    sim.order.disorder = config.reorder_disorder;
+
+    CreateBalls(sim.balls, config, seed);
+
+    // gravity, drag, attractors etc. (no file means the balls just coast like before)
+    std::vector<Physics::ForceField> force_fields;
+
+    Config::LoadForces(config, force_fields, sim.nbody);
+    sim.forces = Physics::BuildForceSet(force_fields);
+
+    // one worker per core for the heavy physics loops unless the config says otherwise
+    Parallel::SetThreadCount(config.threads);
+
+    return SelectStep(config, sim.forces);
+}
+
+// pick the kernel compiled for exactly the stages we need, once, instead of checking every step
+Physics::StepFunction<2> SelectStep(const Config::SimConfig& config, const Physics::ForceSet& forces)
+{
+    const unsigned features = Physics::ForceFeatures(forces) | (config.collisions ? Physics::FEATURE_COLLISIONS : 0);
+    const Physics::StepFunction<2> step = Physics::SelectStepFunction<2>(config.integrator, features);
+    if (step == NULL)
+    {
+        std::cout << "unknown integrator '" << config.integrator << "', try euler, semi-implicit, verlet or rk4" << std::endl;
+    }
+    return step;
+}
+
+// the forces files again, after a reload
+void LoadLiveForces(const Config::SimConfig& config, LiveSettings& live)
+{
+    std::lock_guard<std::mutex> lock(live.mutex);
+
+    std::vector<Physics::ForceField> force_fields;
+    live.nbody = Physics::NBodySettings();
+    Config::LoadForces(config, force_fields, live.nbody);
+    live.forces = Physics::BuildForceSet(force_fields);
+}
+
+// the physics half goes to the simulation thread for its next step and the rest happens here.
+// Existing balls are never touched, so nothing gets lost
+void ApplyLiveSettings(const Config::SimConfig& config, LiveSettings& live, Graphics::ScreenCanvas& screen, Graphics::DensityMap& density_map)
+{
+    {
+        std::lock_guard<std::mutex> lock(live.mutex);
+
+        const Physics::StepFunction<2> step = SelectStep(config, live.forces);
+        live.config = config;
+        live.step = step != NULL ? step : live.step;
+        live.pending = true;
+    }
+
+    // waits for whatever the simulation thread has running on the pool
+    Parallel::SetThreadCount(config.threads);
+
+    screen.density = config.render == "density" ? &density_map : NULL;
+    Graphics::SetMeshCacheBudget(Graphics::mesh_cache, config.mesh_cache_mb * (1 << 20));
+}
+
+// same scene as main() but with a fixed seed and time step so the same build always draws the same pixels
+int RunHeadless(const Config::SimConfig& config)
+{
+    const float dt = 1.0f / 120.0f;
+
+    std::vector<Raylib::Line> window_barriers;
+    CreateWindowBarriers(window_barriers, config.width, config.height);
+
+    Physics::Simulation<2> sim;
+    const Physics::StepFunction<2> step = SetupSimulation(sim, config, config.seed != 0 ? config.seed : 1234);
+    if (step == NULL)
+    {
+        return 1;
+    }
+
+    Graphics::SoftCanvas canvas;
+    Graphics::InitSoftCanvas(canvas, config.width, config.height);
+
+    // recording means drawing every frame, otherwise only the last one matters
+    Graphics::Capture capture;
+    if (!config.record.empty())
+    {
+        Graphics::StartCapture(capture, config.record, config.width, config.height, config.fps, false, true);
+    }
+
+    // spawners and sinks run here too, off their own generator so the same config always draws the same
+    std::mt19937 spawn_gen(config.seed != 0 ? config.seed + 1 : 1235);
+    std::vector<Physics::Spawner> spawners = config.spawners;
+    std::vector<Color> colors;
+    GetBallColors(colors, config);
+    auto make_ball = [&](const Physics::Spawner& spawner) { return SpawnBall(config, colors, spawner, spawn_gen); };
 
-        if ((balls[i].position.y >= (GetScreenHeight() - balls[i].radius)) || (balls[i].position.y <= balls[i].radius))
+    const int frames = config.steps;
+    const std::string& out_path = config.output;
+    const std::string& golden_path = config.golden;
+    for (int frame = 0; frame < frames; ++frame)
+    {
+        Physics::RunSpawners(sim, spawners, dt, make_ball);
+        Physics::RunSinks(sim, config.sinks);
+
+        Update(dt, sim, step);
+
+        if (capture.active)
+        {
+            DrawScene(canvas, window_barriers, sim.balls);
+            Graphics::RasterizeSoftCanvas(canvas);
+            Graphics::CaptureSoftCanvas(capture, canvas);
+        }
+    }
+
+    Graphics::StopCapture(capture);
+
+    DrawScene(canvas, window_barriers, sim.balls);
+    Graphics::RasterizeSoftCanvas(canvas);
+
+    if (golden_path.empty())
+    {
+        if (!Graphics::ExportSoftCanvas(canvas, out_path))
         {
-            balls[i].velocity.y *= -1.0f;
+            std::cout << "couldn't write " << out_path << std::endl;
+            return 1;
         }
+        std::cout << "wrote frame " << frames << " to " << out_path << std::endl;
+        return 0;
+    }
+
+    if (config.bless)
+    {
+        if (!Graphics::ExportSoftCanvas(canvas, golden_path))
+        {
+            std::cout << "couldn't write " << golden_path << std::endl;
+            return 1;
+        }
+        std::cout << "blessed " << golden_path << std::endl;
+        return 0;
+    }
+
+    Graphics::GoldenResult result = Graphics::CompareGolden(canvas, golden_path, out_path, 0, 0);
+    if (result.missing)
+    {
+        std::cout << "no golden image at " << golden_path << ", run again with --bless to write it" << std::endl;
     }
+    else if (result.passed)
+    {
+        std::cout << "golden image matches " << golden_path << std::endl;
+    }
+    else
+    {
+        std::cout << "golden image mismatch: " << result.mismatched << " pixels differ (max difference " << result.max_difference
+                  << "), diff written to " << out_path << std::endl;
+    }
+
+    return result.passed ? 0 : 1;
 }
 
-void CreateWindowBarriers(std::vector<Raylib::Line>& vec)
+void Update(const float dt, Physics::Simulation<2>& sim, const Physics::StepFunction<2> step)
+{
+    step(sim, dt);
+}
+
+// steps at a fixed 120Hz against the real clock and publishes a copy of the balls after every step,
+// if it falls behind it catches up without sleeping but never by more than a quarter of a second
+// anything changed while running gets swapped in between two steps
+void SimulationThread(Physics::Simulation<2>& sim, Parallel::TripleBuffer<Snapshot>& snapshots, LiveSettings& live, std::atomic<bool>& running)
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const float dt = 1.0f / 120.0f;
+    const auto tick = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<float>(dt));
+    auto next = Clock::now();
+    long steps = 0;
+
+    Config::SimConfig settings;
+    Physics::StepFunction<2> step = NULL;
+    std::mt19937 gen(std::random_device{}());
+    std::vector<Color> colors;
+    int remaining = 0;          // balls still to add (or remove if negative) to get to a new ball count
+    float count_budget = 0.0f;
+
+    std::vector<Physics::Spawner> spawners;
+    std::vector<Physics::Spawner> mouse(1, Physics::Spawner{ { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, 0.0f, 0.0f });
+    Physics::BallHandle selected;
+    auto make_ball = [&](const Physics::Spawner& spawner) { return SpawnBall(settings, colors, spawner, gen); };
+
+    while (running)
+    {
+        if (live.pending)
+        {
+            std::lock_guard<std::mutex> lock(live.mutex);
+            remaining = (step == NULL || live.config.balls == settings.balls) ? remaining : live.config.balls - (int)sim.balls.size();
+            settings = live.config;
+            colors.clear();
+            GetBallColors(colors, settings);
+            spawners = settings.spawners;
+            sim.forces = live.forces;
+            sim.nbody = live.nbody;
+            sim.restitution = settings.restitution;
+            sim.broadphase = settings.broadphase;
+            sim.order.every = settings.reorder_every;
+            sim.order.disorder = settings.reorder_disorder;
+            sim.integrator.accel_valid = sim.integrator.accel_valid && step == live.step;      // Verlet's saved acceleration is only good for the same kernel
+            step = live.step;
+            live.pending = false;
+        }
+
+        {
+            Memory::MemoryScope memory(Memory::MEM_POOL);
+            AdjustBallCount(sim, settings, dt, remaining, count_budget, gen);
+
+            mouse[0].rate = live.mouse_down ? std::max(settings.spawn_rate, 1.0f / dt) : 0.0f;
+            mouse[0].position = Vector3{ live.mouse_x, live.mouse_y, 0.0f };
+            mouse[0].spread = settings.speed_max;
+            mouse[0].budget = live.mouse_down ? mouse[0].budget : 0.0f;
+
+            Physics::RunSpawners(sim, spawners, dt, make_ball);
+            Physics::RunSpawners(sim, mouse, dt, make_ball);
+            Physics::RunSinks(sim, settings.sinks);
+        }
+
+        if (live.select_clicked.exchange(false))
+        {
+            selected = Physics::FindBallAt(sim, Vector2{ live.mouse_x, live.mouse_y });
+        }
+
+        Update(dt, sim, step);
+        ++steps;
+
+        Memory::MemoryScope memory(Memory::MEM_SNAPSHOT);
+        Snapshot& snapshot = Parallel::WriteBuffer(snapshots);
+        snapshot.balls = sim.balls;         // only reallocates when the ball count grows
+        snapshot.timings = sim.timings;
+        snapshot.step = steps;
+
+        Physics::SyncHandles(sim.handles, sim.balls.size());
+        snapshot.selected = selected;
+        snapshot.selected_index = Physics::ResolveHandle(sim.handles, selected);
+        Parallel::Publish(snapshots);
+
+        next += tick;
+        const auto now = Clock::now();
+        if (next > now)
+        {
+            std::this_thread::sleep_until(next);
+        }
+        else if (now - next > std::chrono::milliseconds(250))
+        {
+            next = now;
+        }
+    }
+}
+
+void CreateWindowBarriers(std::vector<Raylib::Line>& vec, const int width, const int height)
 {
     Raylib::Line line1;
     Raylib::Line line2;
     Raylib::Line line3;
     Raylib::Line line4;
 
-    line1.CreateLine(1, 1, 511, 1, BLACK);
-    line2.CreateLine(1, 1, 1, 511, BLACK);
-    line3.CreateLine(1, 511, 511, 511, BLACK);
-    line4.CreateLine(511, 1, 511, 511, BLACK);
+    line1.CreateLine(1, 1, width - 1, 1, BLACK);
+    line2.CreateLine(1, 1, 1, height - 1, BLACK);
+    line3.CreateLine(1, height - 1, width - 1, height - 1, BLACK);
+    line4.CreateLine(width - 1, 1, width - 1, height - 1, BLACK);
 
     vec.push_back(line1);
     vec.push_back(line2);
@@ -108,9 +640,15 @@ void CreateWindowBarriers(std::vector<Raylib::Line>& vec)
     vec.push_back(line4);
 }
 
-void CreateBalls(std::vector<Raylib::Circle>& balls, const int num_balls)
+// the config's palette, or the usual ten colours
+void GetBallColors(std::vector<Color>& colors, const Config::SimConfig& config)
 {
-    std::vector<Color> colors;
+    if (!config.palette.empty())
+    {
+        colors = config.palette;
+        return;
+    }
+
     colors.push_back(RED);
     colors.push_back(BLUE);
     colors.push_back(GREEN);
@@ -121,30 +659,217 @@ void CreateBalls(std::vector<Raylib::Circle>& balls, const int num_balls)
     colors.push_back(ORANGE);
     colors.push_back(YELLOW);
     colors.push_back(LIME);
+}
 
-    const float ball_radius = 20.0f;
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<int> dist1(ball_radius, GetScreenWidth() - ball_radius);
-    std::uniform_int_distribution<int> dist2(ball_radius, GetScreenHeight() - ball_radius);
+void CreateBalls(std::vector<Raylib::Circle>& balls, const Config::SimConfig& config, const unsigned seed)
+{
+    std::vector<Color> colors;
+    GetBallColors(colors, config);
+
+    std::mt19937 gen(seed);
+
+    balls.reserve(config.balls);
+    for (int i = 0; i < config.balls; ++i)
+    {
+        balls.push_back(RandomBall(config, colors, gen));
+    }
+}
+
+// one ball somewhere in the window from the config's radius and speed ranges
+Raylib::Circle RandomBall(const Config::SimConfig& config, const std::vector<Color>& colors, std::mt19937& gen)
+{
+    // a fixed radius draws nothing from the generator, so the default config makes the same balls it always has
+    const bool fixed_radius = config.radius_min == config.radius_max;
+    const float max_radius = config.radius_max;
+    std::uniform_int_distribution<int> dist1(max_radius, config.width - max_radius);
+    std::uniform_int_distribution<int> dist2(max_radius, config.height - max_radius);
+    std::uniform_int_distribution<int> sign(0, 1);
     std::uniform_int_distribution<int> colorDist(0, colors.size() - 1);
-    std::uniform_real_distribution<float> vel(250.0f, 500.0f);
+    std::uniform_real_distribution<float> vel(config.speed_min, config.speed_max);
+    std::uniform_real_distribution<float> radius(config.radius_min, config.radius_max);
+
+    int x = dist1(gen);
+    int y = dist2(gen);
+    float speedX = vel(gen) * (sign(gen) == 0 ? 1 : -1);
+    float speedY = vel(gen) * (sign(gen) == 0 ? 1 : -1);
+    Vector2 velocity = {speedX, speedY};
 
-    for (int i = 0; i < num_balls; ++i)
+    int index = colorDist(gen);
+    Color color = colors[index];
+
+    Raylib::Circle ball;
+    ball.CreateCircle(x, y, fixed_radius ? max_radius : radius(gen), color);
+    ball.velocity = velocity;
+
+    return ball;
+}
+
+// a ball out of a spawner, with its velocity plus a bit of spread and nudged about so a stream
+// of them doesn't start out on top of each other
+Raylib::Circle SpawnBall(const Config::SimConfig& config, const std::vector<Color>& colors, const Physics::Spawner& spawner, std::mt19937& gen)
+{
+    std::uniform_real_distribution<float> jitter(-1.0f, 1.0f);
+
+    Raylib::Circle ball = RandomBall(config, colors, gen);
+    ball.position = Vector2{ spawner.position.x + jitter(gen) * ball.radius, spawner.position.y + jitter(gen) * ball.radius };
+    ball.velocity = Vector2{ spawner.velocity.x + jitter(gen) * spawner.spread, spawner.velocity.y + jitter(gen) * spawner.spread };
+    return ball;
+}
+
+// works off a change to the ball count at no more than spawn_rate balls a second (all at once if
+// it's 0), new balls come from RandomBall() and the ones removed come off the end. Spawners and
+// sinks move the count around freely after that
+void AdjustBallCount(Physics::Simulation<2>& sim, const Config::SimConfig& config, const float dt, int& remaining, float& budget, std::mt19937& gen)
+{
+    if (remaining == 0)
     {
-        int x = dist1(gen);
-        int y = dist2(gen);
-        float speedX = vel(gen) * (rand() % 2 == 0 ? 1 : -1);
-        float speedY = vel(gen) * (rand() % 2 == 0 ? 1 : -1);
-        Vector2 velocity = {speedX, speedY};
+        budget = 0.0f;
+        return;
+    }
 
-        int index = colorDist(gen);
-        Color color = colors[index];
+    int change = std::min(abs(remaining), remaining < 0 ? (int)sim.balls.size() : INT_MAX);
+    if (config.spawn_rate > 0.0f)
+    {
+        budget += config.spawn_rate * dt;
+        change = std::min(change, (int)budget);
+        budget -= change;
+    }
 
-        Raylib::Circle ball;
-        ball.CreateCircle(x, y, ball_radius, color);
-        ball.velocity = velocity;
+    std::vector<Color> colors;
+    GetBallColors(colors, config);
 
-        balls.push_back(ball);
+    for (int i = 0; i < change; ++i)
+    {
+        if (remaining > 0)
+        {
+            Physics::AddBall(sim, RandomBall(config, colors, gen));
+        }
+        else
+        {
+            Physics::RemoveBall(sim, sim.balls.size() - 1);
+        }
     }
-}
\ No newline at end of file
+
+    remaining += remaining > 0 ? -change : change;
+    remaining = sim.balls.empty() && remaining < 0 ? 0 : remaining;
+}
+
+int Run3D(const Config::SimConfig& config)
+{
+    const float box_half = 5.0f;
+    float delta_time;
+
+    InitWindow(config.width, config.height, "Bouncy Spheres");
+    Graphics::SetMeshCacheBudget(Graphics::mesh_cache, config.mesh_cache_mb * (1 << 20));
+    SetTargetFPS(config.fps);
+    SetExitKey(KEY_ESCAPE);     // Q rotates the camera in this mode
+
+    // the existing free camera, pulled back far enough to see the whole box
+    Raylib::Camera camera;
+    camera.SetupCamera();
+    camera.cam.position = Vector3{ 0.0f, box_half, 4.0f * box_half };
+
+    Raylib::Cube box;
+    box.CreateCube(Vector3{ 0.0f, 0.0f, 0.0f }, 2.0f * box_half, 2.0f * box_half, 2.0f * box_half, DARKGRAY);
+
+    Physics::Simulation<3> sim;
+    sim.bounds_min = Vector3{ -box_half, -box_half, -box_half };
+    sim.bounds_max = Vector3{ box_half, box_half, box_half };
+
+    sim.broadphase = config.broadphase;
+    sim.restitution = config.restitution;
+    sim.order.every = config.reorder_every;
+    sim.order.disorder = config.reorder_disorder;
+
+    CreateSpheres(sim.balls, config, box_half);
+
+    // 3D has y pointing up and works in metres, so it gets its own force file
+    std::vector<Physics::ForceField> force_fields;
+
+    Config::LoadForces(config, force_fields, sim.nbody);
+    sim.forces = Physics::BuildForceSet(force_fields);
+
+    const unsigned features = Physics::ForceFeatures(sim.forces) | (config.collisions ? Physics::FEATURE_COLLISIONS : 0);
+    const Physics::StepFunction<3> step = Physics::SelectStepFunction<3>(config.integrator, features);
+    if (step == NULL)
+    {
+        std::cout << "unknown integrator '" << config.integrator << "', try euler, semi-implicit, verlet or rk4" << std::endl;
+        CloseWindow();
+        return 1;
+    }
+
+    Parallel::SetThreadCount(config.threads);
+
+    Graphics::SphereRenderer sphere_renderer;
+    Graphics::CubeRenderer cube_renderer;
+    Graphics::LoadSphereRenderer(sphere_renderer);
+    Graphics::LoadCubeRenderer(cube_renderer);
+
+    while (!WindowShouldClose())
+    {
+        // a long frame (dragging the window etc.) would tunnel balls straight through each other
+        delta_time = fminf(GetFrameTime(), 1.0f / 30.0f);
+
+        camera.MoveCamera(delta_time);
+        step(sim, delta_time);
+
+        Render3D(camera, box, cube_renderer, sphere_renderer, sim.balls);
+    }
+
+    Graphics::UnloadSphereRenderer(sphere_renderer);
+    Graphics::UnloadCubeRenderer(cube_renderer);
+    Graphics::UnloadMeshCache(Graphics::mesh_cache);
+    CloseWindow();
+
+    return 0;
+}
+
+void Render3D(Raylib::Camera& camera, Raylib::Cube& box, Graphics::CubeRenderer& cube_renderer, Graphics::SphereRenderer& sphere_renderer, std::vector<Raylib::Sphere>& spheres)
+{
+    BeginDrawing();
+
+    ClearBackground(RAYWHITE);
+
+    BeginMode3D(camera.cam);
+
+    Graphics::BeginCubes(cube_renderer, camera.cam);
+    Graphics::QueueCubeLines(cube_renderer, box, box.color);
+    Graphics::DrawCubes(cube_renderer);
+    Graphics::DrawSpheres(sphere_renderer, camera.cam, spheres);
+    Graphics::DrawQueuedMeshes(Graphics::mesh_cache);
+
+    EndMode3D();
+
+    DrawFPS(2, 2);
+    DrawText(TextFormat("%i spheres, %i drawn, %i culled, %i draw calls", (int)spheres.size(), sphere_renderer.stats.submitted,
+                        sphere_renderer.stats.culled, sphere_renderer.draw_calls), 2, 22, 20, DARKGRAY);
+    DrawText(TextFormat("%i cubes and cylinders, %i drawn, %i culled", cube_renderer.stats.tested, cube_renderer.stats.submitted,
+                        cube_renderer.stats.culled), 2, 44, 20, DARKGRAY);
+
+    std::string text = "Bouncy Sphere Simulation";
+    DrawText(text.c_str(), GetScreenWidth() / 2 - MeasureText(text.c_str(), 30) / 2, 15, 30, BLACK);
+
+    EndDrawing();
+}
+
+void CreateSpheres(std::vector<Raylib::Sphere>& spheres, const Config::SimConfig& config, const float box_half)
+{
+    std::vector<Color> colors;
+    GetBallColors(colors, config);
+
+    std::mt19937 gen(config.seed != 0 ? config.seed : std::random_device()());
+    std::uniform_real_distribution<float> pos(-box_half + 0.2f, box_half - 0.2f);
+    std::uniform_real_distribution<float> radius(config.radius_min, config.radius_max);
+    std::uniform_real_distribution<float> vel(config.speed_min, config.speed_max);
+    std::uniform_int_distribution<int> sign(0, 1);
+    std::uniform_int_distribution<int> colorDist(0, colors.size() - 1);
+
+    for (int i = 0; i < config.balls; ++i)
+    {
+        Raylib::Sphere sphere;
+        sphere.CreateSphere(Vector3{ pos(gen), pos(gen), pos(gen) }, radius(gen), colors[colorDist(gen)]);
+        sphere.velocity = Vector3{ vel(gen) * (sign(gen) == 0 ? 1 : -1), vel(gen) * (sign(gen) == 0 ? 1 : -1), vel(gen) * (sign(gen) == 0 ? 1 : -1) };
+
+        spheres.push_back(sphere);
+    }
+}
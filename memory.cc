@@ -0,0 +1,53 @@
+#include "memory.h"
+
+// the global operator new and delete, see memory.h. Defined once here for the whole program,
+// main and bench both link this in. The over aligned ones (alignas above 16) go through the same
+// counting, their blocks just start further into what malloc gave
+
+void* operator new(std::size_t size)
+{
+    void* p = Memory::Allocate(size);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, std::align_val_t align)
+{
+    void* p = Memory::Allocate(size, (std::size_t)align);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](std::size_t size, std::align_val_t align)
+{
+    return operator new(size, align);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return Memory::Allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return Memory::Allocate(size); }
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return Memory::Allocate(size, (std::size_t)align); }
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return Memory::Allocate(size, (std::size_t)align); }
+
+void operator delete(void* p) noexcept { Memory::Free(p); }
+void operator delete[](void* p) noexcept { Memory::Free(p); }
+void operator delete(void* p, std::size_t) noexcept { Memory::Free(p); }
+void operator delete[](void* p, std::size_t) noexcept { Memory::Free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { Memory::Free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { Memory::Free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { Memory::Free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { Memory::Free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { Memory::Free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { Memory::Free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { Memory::Free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { Memory::Free(p); }
@@ -0,0 +1,238 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <atomic>
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// counts every heap allocation that goes through new (so every std::vector and the rest of the
+// standard containers) by which part of the program asked for it. The global operator new and
+// delete are replaced (in memory.cc, the one place they can be) with ones that put a small header
+// in front of each block saying how big it is and whose it is, so freeing it takes it off the right
+// subsystem's live bytes. Who is asking is a thread local tag set with a MemoryScope, and the
+// scheduler hands it on to the pieces of a loop wherever they end up running. raylib allocates
+// with malloc so it isn't counted.
+//
+// Every thread counts into its own block, nothing is shared while allocating. The blocks are only
+// summed when somebody reads the counts (EndFrame() once a frame), which is also when the high
+// water marks are taken, so they're the most that was live at any of those reads
+
+namespace Memory
+{
+    enum MemoryTag
+    {
+        MEM_OTHER,          // anything nobody claimed
+        MEM_REORDER,
+        MEM_FORCES,
+        MEM_NBODY,
+        MEM_INTEGRATE,
+        MEM_COLLISIONS,     // walls, broadphase, narrowphase and the solver
+        MEM_POOL,           // spawning and removing balls
+        MEM_SNAPSHOT,       // copying the balls out for the render thread
+        MEM_RENDER,
+        MEM_TAG_COUNT
+    };
+
+    inline const char* tag_names[MEM_TAG_COUNT] = { "other", "reorder", "forces", "nbody", "integrate", "collisions", "pool", "snapshot", "render" };
+
+    // one thread's counts, only that thread writes them so they're plain loads and stores, atomic
+    // just so reading them from another thread is allowed. Live bytes go down on whichever thread
+    // frees the block, so one thread's can go below 0 and only the sum means anything
+    typedef struct ThreadCounters
+    {
+        std::atomic<long> allocations[MEM_TAG_COUNT];
+        std::atomic<long> bytes[MEM_TAG_COUNT];         // all ever allocated
+        std::atomic<long> live[MEM_TAG_COUNT];          // allocated and not freed yet
+        ThreadCounters* next;
+
+    } ThreadCounters;
+
+    inline std::atomic<ThreadCounters*> all_threads{ NULL };
+    inline thread_local ThreadCounters* thread_counters = NULL;
+    inline thread_local int current_tag = MEM_OTHER;
+    inline std::atomic<long> peak_live[MEM_TAG_COUNT];          // the high water marks, see ReadCounts()
+
+    // this thread's block, made the first time it allocates. It comes from malloc since this runs
+    // inside operator new, and it's never freed so what a finished thread counted stays in the sums
+    inline ThreadCounters& Counters()
+    {
+        if (thread_counters == NULL)
+        {
+            ThreadCounters* counters = new (std::calloc(1, sizeof(ThreadCounters))) ThreadCounters();
+            counters->next = all_threads.load(std::memory_order_relaxed);
+            while (!all_threads.compare_exchange_weak(counters->next, counters, std::memory_order_release, std::memory_order_relaxed))
+            {
+            }
+            thread_counters = counters;
+        }
+        return *thread_counters;
+    }
+
+    inline void Add(std::atomic<long>& counter, const long n)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    // in front of every block, 16 bytes so what comes after keeps the alignment new promises.
+    // offset is how far the block is from what malloc gave, more than the header for over aligned blocks
+    typedef struct alignas(16) BlockHeader
+    {
+        std::size_t size;
+        int tag;
+        int offset;
+
+    } BlockHeader;
+
+    inline void* Allocate(const std::size_t size, const std::size_t align = alignof(BlockHeader))
+    {
+        const std::size_t extra = align > sizeof(BlockHeader) ? align : 0;
+        char* base = (char*)std::malloc(sizeof(BlockHeader) + extra + size);
+        if (base == NULL)
+        {
+            return NULL;
+        }
+
+        char* p = base + sizeof(BlockHeader);
+        if (extra > 0)
+        {
+            p = (char*)(((std::uintptr_t)p + align - 1) & ~(std::uintptr_t)(align - 1));
+        }
+
+        BlockHeader* header = (BlockHeader*)p - 1;
+        header->size = size;
+        header->tag = current_tag;
+        header->offset = p - base;
+
+        ThreadCounters& counters = Counters();
+        Add(counters.allocations[header->tag], 1);
+        Add(counters.bytes[header->tag], size);
+        Add(counters.live[header->tag], size);
+
+        return p;
+    }
+
+    inline void Free(void* p)
+    {
+        if (p == NULL)
+        {
+            return;
+        }
+        BlockHeader* header = (BlockHeader*)p - 1;
+        Add(Counters().live[header->tag], -(long)header->size);
+        std::free((char*)p - header->offset);
+    }
+
+    // allocations made while one of these is alive belong to tag, they nest
+    typedef struct MemoryScope
+    {
+        int previous;
+
+        MemoryScope(const int tag) : previous(current_tag) { current_tag = tag; }
+        ~MemoryScope() { current_tag = previous; }
+
+    } MemoryScope;
+
+    // the running totals, the difference of two is what got allocated in between
+    typedef struct MemoryCounts
+    {
+        long allocations[MEM_TAG_COUNT] = {};
+        long bytes[MEM_TAG_COUNT] = {};
+        long live[MEM_TAG_COUNT] = {};
+
+    } MemoryCounts;
+
+    // sums every thread's block, and raises the high water marks to what's live now
+    inline void ReadCounts(MemoryCounts& counts)
+    {
+        counts = MemoryCounts();
+        for (ThreadCounters* c = all_threads.load(std::memory_order_acquire); c != NULL; c = c->next)
+        {
+            for (int t = 0; t < MEM_TAG_COUNT; ++t)
+            {
+                counts.allocations[t] += c->allocations[t].load(std::memory_order_relaxed);
+                counts.bytes[t] += c->bytes[t].load(std::memory_order_relaxed);
+                counts.live[t] += c->live[t].load(std::memory_order_relaxed);
+            }
+        }
+
+        for (int t = 0; t < MEM_TAG_COUNT; ++t)
+        {
+            if (counts.live[t] > peak_live[t].load(std::memory_order_relaxed))
+            {
+                peak_live[t].store(counts.live[t], std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // the most that was live at any ReadCounts()
+    inline long PeakLiveBytes(const int tag)
+    {
+        return peak_live[tag].load(std::memory_order_relaxed);
+    }
+
+    // what the process has in RAM right now, 0 if /proc can't say
+    inline long ResidentKB()
+    {
+        long pages = 0;
+        FILE* f = fopen("/proc/self/statm", "r");
+        if (f != NULL)
+        {
+            if (fscanf(f, "%*d %ld", &pages) != 1)
+            {
+                pages = 0;
+            }
+            fclose(f);
+        }
+        return pages * (sysconf(_SC_PAGESIZE) / 1024);
+    }
+
+    // the most it's ever had
+    inline long PeakResidentKB()
+    {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return std::max((long)usage.ru_maxrss, ResidentKB());      // ru_maxrss can lag behind what statm already says
+    }
+
+    // per frame counts for the overlay, EndFrame() once a frame works out what the frame just gone
+    // allocated. Resident memory is only read every so often since it means reading /proc
+    typedef struct FrameMemory
+    {
+        MemoryCounts start;             // the totals when this frame started
+        MemoryCounts last;              // what the last whole frame allocated
+        long frames = 0;
+        long allocating_frames = 0;     // frames that allocated anything at all
+        long rss_kb = 0;
+        long peak_rss_kb = 0;
+
+    } FrameMemory;
+
+    inline void EndFrame(FrameMemory& memory)
+    {
+        MemoryCounts now;
+        ReadCounts(now);
+
+        bool allocated = false;
+        for (int t = 0; t < MEM_TAG_COUNT; ++t)
+        {
+            memory.last.allocations[t] = now.allocations[t] - memory.start.allocations[t];
+            memory.last.bytes[t] = now.bytes[t] - memory.start.bytes[t];
+            allocated |= memory.last.allocations[t] > 0;
+        }
+        memory.start = now;
+
+        memory.allocating_frames += (allocated && memory.frames > 0) ? 1 : 0;
+        if (memory.frames++ % 30 == 0)
+        {
+            memory.rss_kb = ResidentKB();
+            memory.peak_rss_kb = PeakResidentKB();
+        }
+    }
+};
+
+#endif
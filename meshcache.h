@@ -0,0 +1,522 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <raylib.h>
+#include <rlgl.h>
+#include <raymath.h>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+// meshes that only depend on a handful of shape parameters get built and uploaded to the GPU once,
+// and after that drawing one is just binding its VBOs. Parameters are quantized before they go in
+// the key so 1.0 and 1.0000001 share a mesh, and the key also carries the level of detail (how many
+// slices or segments) the mesh was tessellated at.
+//
+// the cache holds at most budget_bytes ('mesh_cache' in sim.cfg), past that the least recently used meshes get unloaded.
+//
+// shapes can be drawn one by one with DrawCachedMesh(), or queued with QueueCachedMesh() when there
+// are a lot of them, DrawQueuedMeshes() (once a frame from the render loops) then draws every copy
+// of the same mesh in the same colour with one instanced draw call
+
+#ifndef MAX_MATERIAL_MAPS
+#define MAX_MATERIAL_MAPS 12        // from raylib's config.h, DrawMesh() looks at all of them
+#endif
+
+namespace Graphics
+{
+    enum MeshShape
+    {
+        MESH_TEXTURED_CUBE,     // params: size
+        MESH_CYLINDER,          // params: top radius, bottom radius, height, lod: slices
+        MESH_ELLIPSE            // params: horizontal radius, vertical radius, lod: segments
+    };
+
+    typedef struct MeshKey
+    {
+        int shape;
+        int params[4];
+        int lod;
+
+        bool operator==(const MeshKey& other) const
+        {
+            return shape == other.shape && lod == other.lod && params[0] == other.params[0] && params[1] == other.params[1] &&
+                   params[2] == other.params[2] && params[3] == other.params[3];
+        }
+
+    } MeshKey;
+
+    typedef struct MeshKeyHash
+    {
+        size_t operator()(const MeshKey& key) const
+        {
+            size_t h = key.shape * 31 + key.lod;
+            for (int i = 0; i < 4; ++i)
+            {
+                h = h * 0x9E3779B97F4A7C15ull + (unsigned)key.params[i];
+            }
+            return h ^ (h >> 29);
+        }
+
+    } MeshKeyHash;
+
+    // a handle is only good until the next FindOrBuildMesh() call, that one might evict it (unless
+    // it's queued, those stay until DrawQueuedMeshes())
+    typedef int MeshHandle;
+
+    typedef struct CachedMesh
+    {
+        Mesh mesh;
+        MeshKey key;
+        size_t bytes;
+        unsigned long last_used;
+        bool loaded;
+        int queued;             // copies waiting for DrawQueuedMeshes(), it can't be evicted until they're drawn
+
+    } CachedMesh;
+
+    typedef struct QueuedMesh
+    {
+        MeshHandle handle;
+        Color color;
+        Matrix transform;
+
+    } QueuedMesh;
+
+    typedef struct MeshCache
+    {
+        std::unordered_map<MeshKey, MeshHandle, MeshKeyHash> lookup;
+        std::vector<CachedMesh> slots;
+        std::vector<MeshHandle> free_slots;
+        size_t budget_bytes = 8 << 20;
+        size_t bytes_used = 0;
+        unsigned long clock = 0;
+        bool upload = true;                 // false keeps new meshes on the CPU, for checks that run without a window
+
+        std::vector<QueuedMesh> queued;
+        std::vector<Matrix> transforms;     // one instanced draw's worth, kept between frames
+        Material material;                  // flat colour instancing shader, loaded by the first draw
+        bool material_loaded = false;
+
+        // so the overlay can show how well it's doing
+        int hits = 0;
+        int misses = 0;
+        int evictions = 0;
+        int draw_calls = 0;
+
+    } MeshCache;
+
+    inline MeshCache mesh_cache;
+
+    // 1/1024 of a unit is finer than anyone will notice on screen
+    inline int QuantizeParam(float value)
+    {
+        return (int)lroundf(value * 1024.0f);
+    }
+
+    inline float DequantizeParam(int value)
+    {
+        return value / 1024.0f;
+    }
+
+    // what a mesh costs, counted twice because UploadMesh() keeps the CPU arrays around next to the VBOs
+    inline size_t MeshBytes(const Mesh& mesh)
+    {
+        size_t bytes = 0;
+        bytes += mesh.vertices ? mesh.vertexCount * 3 * sizeof(float) : 0;
+        bytes += mesh.normals ? mesh.vertexCount * 3 * sizeof(float) : 0;
+        bytes += mesh.texcoords ? mesh.vertexCount * 2 * sizeof(float) : 0;
+        bytes += mesh.colors ? mesh.vertexCount * 4 : 0;
+        bytes += mesh.indices ? mesh.triangleCount * 3 * sizeof(unsigned short) : 0;
+        return 2 * bytes;
+    }
+
+    inline void EvictMesh(MeshCache& cache, MeshHandle handle)
+    {
+        CachedMesh& slot = cache.slots[handle];
+
+        UnloadMesh(slot.mesh);
+        cache.lookup.erase(slot.key);
+        cache.bytes_used -= slot.bytes;
+        cache.free_slots.push_back(handle);
+        slot.loaded = false;
+        ++cache.evictions;
+    }
+
+    // unloads least recently used meshes until there's room for another extra bytes,
+    // a linear scan is fine, the cache only ever holds a few hundred meshes
+    inline void TrimMeshCache(MeshCache& cache, size_t extra)
+    {
+        while (cache.bytes_used + extra > cache.budget_bytes)
+        {
+            MeshHandle oldest = -1;
+            for (int i = 0; i < cache.slots.size(); ++i)
+            {
+                if (cache.slots[i].loaded && cache.slots[i].queued == 0 && (oldest < 0 || cache.slots[i].last_used < cache.slots[oldest].last_used))
+                {
+                    oldest = i;
+                }
+            }
+
+            if (oldest < 0)
+            {
+                break;
+            }
+            EvictMesh(cache, oldest);
+        }
+    }
+
+    inline void SetMeshCacheBudget(MeshCache& cache, size_t bytes)
+    {
+        cache.budget_bytes = bytes;
+        TrimMeshCache(cache, 0);
+    }
+
+    // build(key) only runs when the key isn't cached, it has to return a mesh with its arrays
+    // allocated through MemAlloc() so the cache can free it later. A single mesh bigger than the
+    // whole budget still gets cached, it just pushes everything else out
+    template <typename BuildFn>
+    MeshHandle FindOrBuildMesh(MeshCache& cache, const MeshKey& key, BuildFn build)
+    {
+        auto found = cache.lookup.find(key);
+        if (found != cache.lookup.end())
+        {
+            cache.slots[found->second].last_used = ++cache.clock;
+            ++cache.hits;
+            return found->second;
+        }
+
+        ++cache.misses;
+        Mesh mesh = build(key);
+        const size_t bytes = MeshBytes(mesh);
+
+        TrimMeshCache(cache, bytes);
+        if (cache.upload)
+        {
+            UploadMesh(&mesh, false);
+        }
+
+        MeshHandle handle;
+        if (!cache.free_slots.empty())
+        {
+            handle = cache.free_slots.back();
+            cache.free_slots.pop_back();
+        }
+        else
+        {
+            handle = cache.slots.size();
+            cache.slots.push_back(CachedMesh{});
+        }
+
+        cache.slots[handle] = CachedMesh{ mesh, key, bytes, ++cache.clock, true, 0 };
+        cache.lookup[key] = handle;
+        cache.bytes_used += bytes;
+        return handle;
+    }
+
+    inline const Mesh& GetMesh(const MeshCache& cache, MeshHandle handle)
+    {
+        return cache.slots[handle].mesh;
+    }
+
+    inline void UnloadMeshCache(MeshCache& cache)
+    {
+        for (int i = 0; i < cache.slots.size(); ++i)
+        {
+            if (cache.slots[i].loaded)
+            {
+                UnloadMesh(cache.slots[i].mesh);
+            }
+        }
+        cache.slots.clear();
+        cache.free_slots.clear();
+        cache.lookup.clear();
+        cache.queued.clear();
+        cache.bytes_used = 0;
+
+        if (cache.material_loaded)
+        {
+            UnloadMaterial(cache.material);         // the shader and the maps
+            cache.material_loaded = false;
+        }
+    }
+
+    // raylib binds instanceTransform and fills mvp and colDiffuse itself
+    inline const char* cached_mesh_vs = R"(
+        #version 330
+        in vec3 vertexPosition;
+        in mat4 instanceTransform;
+        uniform mat4 mvp;
+
+        void main()
+        {
+            gl_Position = mvp * instanceTransform * vec4(vertexPosition, 1.0);
+        }
+    )";
+
+    inline const char* cached_mesh_fs = R"(
+        #version 330
+        uniform vec4 colDiffuse;
+        out vec4 finalColor;
+
+        void main()
+        {
+            finalColor = colDiffuse;
+        }
+    )";
+
+    // draws a cached mesh flat shaded in one colour with raylib's default shader, the same look
+    // DrawCylinder() and DrawEllipse() have. Anything already batched goes out first so it stays underneath
+    inline void DrawCachedMesh(const MeshCache& cache, MeshHandle handle, const Color& color, const Matrix& transform)
+    {
+        MaterialMap maps[MAX_MATERIAL_MAPS] = {};
+        maps[MATERIAL_MAP_DIFFUSE].texture = Texture2D{ rlGetTextureIdDefault(), 1, 1, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+        maps[MATERIAL_MAP_DIFFUSE].color = color;
+
+        Material material = {};
+        material.shader = Shader{ rlGetShaderIdDefault(), rlGetShaderLocsDefault() };
+        material.maps = maps;
+
+        rlDrawRenderBatchActive();
+        DrawMesh(GetMesh(cache, handle), material, transform);
+    }
+
+    // a copy of a cached mesh, flat shaded in one colour (the same look DrawCylinder() and DrawEllipse()
+    // have), that goes out with the next DrawQueuedMeshes()
+    inline void QueueCachedMesh(MeshCache& cache, MeshHandle handle, const Color& color, const Matrix& transform)
+    {
+        cache.queued.push_back(QueuedMesh{ handle, color, transform });
+        ++cache.slots[handle].queued;
+    }
+
+    inline unsigned int PackColor(const Color& color)
+    {
+        return ((unsigned int)color.r << 24) | ((unsigned int)color.g << 16) | ((unsigned int)color.b << 8) | color.a;
+    }
+
+    // hands everything queued to draw(handle, color, transforms, count), one call per mesh and colour,
+    // and empties the queue so the meshes can be evicted again. The order between different meshes
+    // and colours isn't kept
+    template <typename DrawFn>
+    void FlushQueuedMeshes(MeshCache& cache, DrawFn draw)
+    {
+        std::stable_sort(cache.queued.begin(), cache.queued.end(), [](const QueuedMesh& a, const QueuedMesh& b)
+        {
+            return a.handle != b.handle ? a.handle < b.handle : PackColor(a.color) < PackColor(b.color);
+        });
+
+        for (int start = 0; start < cache.queued.size();)
+        {
+            const QueuedMesh& first = cache.queued[start];
+
+            cache.transforms.clear();
+            int end = start;
+            while (end < cache.queued.size() && cache.queued[end].handle == first.handle && PackColor(cache.queued[end].color) == PackColor(first.color))
+            {
+                cache.transforms.push_back(cache.queued[end].transform);
+                ++end;
+            }
+
+            draw(first.handle, first.color, cache.transforms.data(), (int)cache.transforms.size());
+            ++cache.draw_calls;
+
+            cache.slots[first.handle].queued = 0;
+            start = end;
+        }
+
+        cache.queued.clear();
+    }
+
+    // draws everything queued with instancing, in the same mode (2D screen space or inside
+    // BeginMode3D()) the shapes were queued for. Anything already batched goes out first so it stays underneath
+    inline void DrawQueuedMeshes(MeshCache& cache)
+    {
+        if (cache.queued.empty())
+        {
+            return;
+        }
+
+        if (!cache.material_loaded)
+        {
+            cache.material = LoadMaterialDefault();
+            cache.material.shader = LoadShaderFromMemory(cached_mesh_vs, cached_mesh_fs);
+            cache.material_loaded = true;
+        }
+
+        rlDrawRenderBatchActive();
+
+        FlushQueuedMeshes(cache, [&](MeshHandle handle, const Color& color, const Matrix* transforms, int count)
+        {
+            cache.material.maps[MATERIAL_MAP_DIFFUSE].color = color;
+            DrawMeshInstanced(GetMesh(cache, handle), cache.material, transforms, count);
+        });
+    }
+
+    // enough segments that the polygon is never more than about half a pixel inside the real curve
+    inline int EllipseSegments(float max_radius)
+    {
+        if (max_radius <= 1.0f)
+        {
+            return 8;
+        }
+
+        int segments = (int)ceilf(PI / acosf(1.0f - 0.5f / max_radius));
+        segments = (segments + 3) & ~3;
+        return segments < 8 ? 8 : (segments > 256 ? 256 : segments);
+    }
+
+    // all 6 faces, wound counter clockwise from outside so backface culling keeps the right ones,
+    // each face gets its own 4 vertices so the normals and uvs stay flat
+    inline Mesh BuildTexturedCube(const MeshKey& key)
+    {
+        const float h = 0.5f * DequantizeParam(key.params[0]);
+
+        // per face: the normal, then the axes the u and v texture coordinates run along
+        const Vector3 faces[6][3] = {
+            { {  0,  0,  1 }, {  1, 0,  0 }, { 0, 1,  0 } },     // front
+            { {  0,  0, -1 }, { -1, 0,  0 }, { 0, 1,  0 } },     // back
+            { { -1,  0,  0 }, {  0, 0,  1 }, { 0, 1,  0 } },     // left
+            { {  1,  0,  0 }, {  0, 0, -1 }, { 0, 1,  0 } },     // right
+            { {  0,  1,  0 }, {  1, 0,  0 }, { 0, 0, -1 } },     // top
+            { {  0, -1,  0 }, {  1, 0,  0 }, { 0, 0,  1 } }      // bottom
+        };
+        const float corner_uv[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+
+        Mesh mesh = {};
+        mesh.vertexCount = 24;
+        mesh.triangleCount = 12;
+        mesh.vertices = (float*)MemAlloc(mesh.vertexCount * 3 * sizeof(float));
+        mesh.normals = (float*)MemAlloc(mesh.vertexCount * 3 * sizeof(float));
+        mesh.texcoords = (float*)MemAlloc(mesh.vertexCount * 2 * sizeof(float));
+        mesh.indices = (unsigned short*)MemAlloc(mesh.triangleCount * 3 * sizeof(unsigned short));
+
+        for (int f = 0; f < 6; ++f)
+        {
+            const Vector3& n = faces[f][0];
+            const Vector3& u = faces[f][1];
+            const Vector3& v = faces[f][2];
+
+            for (int c = 0; c < 4; ++c)
+            {
+                const int i = f * 4 + c;
+                const float su = corner_uv[c][0] * 2.0f - 1.0f;
+                const float sv = corner_uv[c][1] * 2.0f - 1.0f;
+                const Vector3 p = (n + u * su + v * sv) * h;
+
+                mesh.vertices[i * 3 + 0] = p.x;
+                mesh.vertices[i * 3 + 1] = p.y;
+                mesh.vertices[i * 3 + 2] = p.z;
+                mesh.normals[i * 3 + 0] = n.x;
+                mesh.normals[i * 3 + 1] = n.y;
+                mesh.normals[i * 3 + 2] = n.z;
+                mesh.texcoords[i * 2 + 0] = corner_uv[c][0];
+                mesh.texcoords[i * 2 + 1] = 1.0f - corner_uv[c][1];
+            }
+
+            const unsigned short quad[6] = { 0, 1, 2, 0, 2, 3 };
+            for (int k = 0; k < 6; ++k)
+            {
+                mesh.indices[f * 6 + k] = f * 4 + quad[k];
+            }
+        }
+
+        return mesh;
+    }
+
+    // same shape DrawCylinder() makes: base centred on the origin, top at y = height,
+    // smooth sides plus a cap on each end that has a radius
+    inline Mesh BuildCylinder(const MeshKey& key)
+    {
+        const float radius_top = DequantizeParam(key.params[0]);
+        const float radius_bottom = DequantizeParam(key.params[1]);
+        const float height = DequantizeParam(key.params[2]);
+        const int slices = key.lod;
+        const float step = 2.0f * PI / slices;
+
+        const int caps = (radius_top > 0.0f) + (radius_bottom > 0.0f);
+
+        Mesh mesh = {};
+        mesh.triangleCount = slices * (2 + caps);
+        mesh.vertexCount = mesh.triangleCount * 3;
+        mesh.vertices = (float*)MemAlloc(mesh.vertexCount * 3 * sizeof(float));
+        mesh.normals = (float*)MemAlloc(mesh.vertexCount * 3 * sizeof(float));
+
+        int v = 0;
+        auto emit = [&](const Vector3& p, const Vector3& n)
+        {
+            mesh.vertices[v * 3 + 0] = p.x;
+            mesh.vertices[v * 3 + 1] = p.y;
+            mesh.vertices[v * 3 + 2] = p.z;
+            mesh.normals[v * 3 + 0] = n.x;
+            mesh.normals[v * 3 + 1] = n.y;
+            mesh.normals[v * 3 + 2] = n.z;
+            ++v;
+        };
+
+        // a cone's side normal leans up by how much the radius shrinks per unit of height
+        const float slope = height > 0.0f ? (radius_bottom - radius_top) / height : 0.0f;
+
+        for (int i = 0; i < slices; ++i)
+        {
+            const float s0 = sinf(i * step), c0 = cosf(i * step);
+            const float s1 = sinf((i + 1) * step), c1 = cosf((i + 1) * step);
+
+            const Vector3 b0 = { s0 * radius_bottom, 0.0f, c0 * radius_bottom };
+            const Vector3 b1 = { s1 * radius_bottom, 0.0f, c1 * radius_bottom };
+            const Vector3 t0 = { s0 * radius_top, height, c0 * radius_top };
+            const Vector3 t1 = { s1 * radius_top, height, c1 * radius_top };
+            const Vector3 n0 = Vector3Normalize(Vector3{ s0, slope, c0 });
+            const Vector3 n1 = Vector3Normalize(Vector3{ s1, slope, c1 });
+
+            emit(b0, n0); emit(b1, n1); emit(t1, n1);
+            emit(b0, n0); emit(t1, n1); emit(t0, n0);
+
+            if (radius_top > 0.0f)
+            {
+                const Vector3 up = { 0.0f, 1.0f, 0.0f };
+                emit(Vector3{ 0.0f, height, 0.0f }, up); emit(t0, up); emit(t1, up);
+            }
+
+            if (radius_bottom > 0.0f)
+            {
+                const Vector3 down = { 0.0f, -1.0f, 0.0f };
+                emit(Vector3{ 0.0f, 0.0f, 0.0f }, down); emit(b1, down); emit(b0, down);
+            }
+        }
+
+        return mesh;
+    }
+
+    // a triangle fan around the origin in screen space, wound the same way DrawEllipse() winds it
+    inline Mesh BuildEllipse(const MeshKey& key)
+    {
+        const float radius_h = DequantizeParam(key.params[0]);
+        const float radius_v = DequantizeParam(key.params[1]);
+        const int segments = key.lod;
+        const float step = 2.0f * PI / segments;
+
+        Mesh mesh = {};
+        mesh.vertexCount = segments + 1;
+        mesh.triangleCount = segments;
+        mesh.vertices = (float*)MemAlloc(mesh.vertexCount * 3 * sizeof(float));
+        mesh.indices = (unsigned short*)MemAlloc(mesh.triangleCount * 3 * sizeof(unsigned short));
+
+        mesh.vertices[0] = mesh.vertices[1] = mesh.vertices[2] = 0.0f;
+        for (int i = 0; i < segments; ++i)
+        {
+            mesh.vertices[(i + 1) * 3 + 0] = sinf(i * step) * radius_h;
+            mesh.vertices[(i + 1) * 3 + 1] = cosf(i * step) * radius_v;
+            mesh.vertices[(i + 1) * 3 + 2] = 0.0f;
+
+            mesh.indices[i * 3 + 0] = 0;
+            mesh.indices[i * 3 + 1] = (i + 1) % segments + 1;
+            mesh.indices[i * 3 + 2] = i + 1;
+        }
+
+        return mesh;
+    }
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef MORTON_H
+#define MORTON_H
+
+#include "defs.h"
+#include "dimension.h"
+#include "sort.h"
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+// balls are stored in the order they were made, so two balls touching on screen are usually far
+// apart in memory and the broadphase, narrowphase and solver jump all over the arrays. Sorting the
+// arrays along a Z-order (Morton) curve every so often puts balls that are close in space close in
+// memory. The key interleaves the bits of the quantized coordinates, 16 per axis in 2D and 10 in 3D
+
+namespace Physics
+{
+    // when to sort again, either every so many steps or once balls have changed grid cell enough
+    // times since the last sort (which only gets counted while the grid broadphase is running)
+    template <int D>
+    struct BallOrder
+    {
+        int every = 0;                  // steps between sorts, 0 for never
+        float disorder = 1.0f;          // cell changes since the last sort per ball, 0 for never
+
+        int steps = 0;                  // since the last sort
+        long moved = 0;
+        int sorted = 0;                 // ball count at the last sort, balls added or removed since count as moved
+        int sorts = 0;
+
+        std::vector<uint32_t> keys;
+        std::vector<int> order;
+        Parallel::RadixScratch<uint32_t> scratch;
+        std::vector<typename Dimension<D>::Body> temp;
+    };
+
+    // spreads the low 16 bits out to every other bit
+    inline uint32_t SpreadBits2(uint32_t x)
+    {
+        x &= 0x0000ffff;
+        x = (x | (x << 8)) & 0x00ff00ff;
+        x = (x | (x << 4)) & 0x0f0f0f0f;
+        x = (x | (x << 2)) & 0x33333333;
+        x = (x | (x << 1)) & 0x55555555;
+        return x;
+    }
+
+    // spreads the low 10 bits out to every third bit
+    inline uint32_t SpreadBits3(uint32_t x)
+    {
+        x &= 0x000003ff;
+        x = (x | (x << 16)) & 0x030000ff;
+        x = (x | (x << 8)) & 0x0300f00f;
+        x = (x | (x << 4)) & 0x030c30c3;
+        x = (x | (x << 2)) & 0x09249249;
+        return x;
+    }
+
+    inline uint32_t MortonCode(const uint32_t* q, const int dims)
+    {
+        if (dims == 2)
+        {
+            return SpreadBits2(q[0]) | (SpreadBits2(q[1]) << 1);
+        }
+        return SpreadBits3(q[0]) | (SpreadBits3(q[1]) << 1) | (SpreadBits3(q[2]) << 2);
+    }
+
+    // a position inside [lo, hi] to its key, anything outside gets clamped to the edge
+    template <int D>
+    inline uint32_t MortonKey(const typename Dimension<D>::Vec& pos, const typename Dimension<D>::Vec& lo, const typename Dimension<D>::Vec& hi)
+    {
+        const float steps = (D == 2) ? 65535.0f : 1023.0f;
+
+        uint32_t q[3] = { 0, 0, 0 };
+        for (int axis = 0; axis < D; ++axis)
+        {
+            const float extent = std::max(Component(hi, axis) - Component(lo, axis), 1e-6f);
+            const float t = std::clamp((Component(pos, axis) - Component(lo, axis)) / extent, 0.0f, 1.0f);
+            q[axis] = (uint32_t)(t * steps);
+        }
+        return MortonCode(q, D);
+    }
+
+    template <int D>
+    bool ReorderDue(const BallOrder<D>& order, const int n)
+    {
+        const long moved = order.moved + std::abs(n - order.sorted);
+        return (order.every > 0 && order.steps >= order.every) || (order.disorder > 0.0f && moved > order.disorder * n);
+    }
+
+    // works out the Z-order of the balls and puts them in it. order.order is left saying where each
+    // ball came from (new index -> old index) so anything else kept per ball can follow them
+    template <int D>
+    void SortBalls(BallOrder<D>& order, std::vector<typename Dimension<D>::Body>& balls, const typename Dimension<D>::Vec& lo, const typename Dimension<D>::Vec& hi)
+    {
+        const int n = balls.size();
+
+        order.keys.resize(n);
+        order.order.resize(n);
+        order.temp.resize(n);
+
+        Parallel::For(0, n, [&](int start, int stop, int)
+        {
+            for (int i = start; i < stop; ++i)
+            {
+                order.keys[i] = MortonKey<D>(Position(balls[i]), lo, hi);
+                order.order[i] = i;
+            }
+        });
+
+        Parallel::RadixSort(order.keys, order.order, order.scratch);
+
+        Parallel::For(0, n, [&](int start, int stop, int)
+        {
+            for (int i = start; i < stop; ++i)
+            {
+                order.temp[i] = balls[order.order[i]];
+            }
+        });
+        balls.swap(order.temp);
+
+        order.steps = 0;
+        order.moved = 0;
+        order.sorted = n;
+        ++order.sorts;
+    }
+};
+
+#endif
@@ -0,0 +1,459 @@
+#ifndef NBODY_H
+#define NBODY_H
+
+#include "defs.h"
+#include "forces.h"
+#include "dimension.h"
+#include "parallel.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// balls attracting each other, either the exact O(n^2) sum or a Barnes-Hut quadtree
+// which treats far away clumps of balls as a single point mass, so O(n log n)
+// (the tree is 2D only, 3D always takes the brute force path)
+
+namespace Physics
+{
+    typedef struct QuadNode
+    {
+        Vector2 com;            // centre of mass
+        float mass;
+        Vector2 center;         // square cell, centre and half width
+        float half;
+        int child[4];           // -1 for an empty quadrant
+        int first, count;       // leaves hold a range of QuadTree::order, internal nodes have count 0
+
+    } QuadNode;
+
+    typedef struct QuadTree
+    {
+        std::vector<QuadNode> nodes;        // nodes[0] is the root
+        std::vector<int> order;             // ball indices sorted so every leaf is a contiguous range
+        std::vector<Vector2> pos;           // copies in tree order so leaf loops walk memory linearly
+        std::vector<float> mass;
+
+        // scratch kept between builds so rebuilding every step doesn't allocate
+        std::vector<int> cell_of, start, fill;
+        std::vector<std::vector<QuadNode>> subtrees;
+        std::vector<int> level, parents;
+
+        static const int leaf_size = 8;
+        static const int max_depth = 24;    // stacked balls can't be split forever
+        static const int split_levels = 2;  // the top 2 levels give 16 subtrees to build in parallel
+
+    } QuadTree;
+
+    // builds the subtree over order[lo, hi) into nodes and returns its index
+    inline int BuildQuadNode(QuadTree& tree, std::vector<QuadNode>& nodes, int lo, int hi, Vector2 center, float half, int depth)
+    {
+        QuadNode node;
+        node.center = center;
+        node.half = half;
+        node.child[0] = node.child[1] = node.child[2] = node.child[3] = -1;
+        node.first = lo;
+        node.count = 0;
+        node.mass = 0.0f;
+        node.com = Vector2{ 0.0f, 0.0f };
+
+        const int index = nodes.size();
+        nodes.push_back(node);
+
+        if (hi - lo <= QuadTree::leaf_size || depth >= QuadTree::max_depth)
+        {
+            float m = 0.0f, cx = 0.0f, cy = 0.0f;
+            for (int i = lo; i < hi; ++i)
+            {
+                m += tree.mass[i];
+                cx += tree.mass[i] * tree.pos[i].x;
+                cy += tree.mass[i] * tree.pos[i].y;
+            }
+
+            nodes[index].count = hi - lo;
+            nodes[index].mass = m;
+            nodes[index].com = (m > 0.0f) ? Vector2{ cx / m, cy / m } : center;
+            return index;
+        }
+
+        // partition into the 4 quadrants: bit 0 is right of centre, bit 1 is below it
+        int bounds[5];
+        bounds[0] = lo;
+        bounds[4] = hi;
+
+        auto split = [&](int a, int b, auto pred)
+        {
+            int mid = a;
+            for (int i = a; i < b; ++i)
+            {
+                if (pred(tree.pos[i]))
+                {
+                    std::swap(tree.pos[i], tree.pos[mid]);
+                    std::swap(tree.mass[i], tree.mass[mid]);
+                    std::swap(tree.order[i], tree.order[mid]);
+                    ++mid;
+                }
+            }
+            return mid;
+        };
+
+        bounds[2] = split(lo, hi, [&](const Vector2& p) { return p.y < center.y; });
+        bounds[1] = split(lo, bounds[2], [&](const Vector2& p) { return p.x < center.x; });
+        bounds[3] = split(bounds[2], hi, [&](const Vector2& p) { return p.x < center.x; });
+
+        float m = 0.0f, cx = 0.0f, cy = 0.0f;
+        const float q = half * 0.5f;
+
+        for (int c = 0; c < 4; ++c)
+        {
+            if (bounds[c] == bounds[c + 1])
+            {
+                continue;
+            }
+
+            Vector2 child_center = { center.x + ((c & 1) ? q : -q), center.y + ((c & 2) ? q : -q) };
+            int child = BuildQuadNode(tree, nodes, bounds[c], bounds[c + 1], child_center, q, depth + 1);
+
+            nodes[index].child[c] = child;
+            m += nodes[child].mass;
+            cx += nodes[child].mass * nodes[child].com.x;
+            cy += nodes[child].mass * nodes[child].com.y;
+        }
+
+        nodes[index].mass = m;
+        nodes[index].com = (m > 0.0f) ? Vector2{ cx / m, cy / m } : center;
+        return index;
+    }
+
+    // rebuilt from scratch every step, the top split_levels are bucketed serially with a
+    // counting sort and then every subtree below them is built on its own thread
+    inline void BuildQuadTree(QuadTree& tree, const std::vector<Raylib::Circle>& balls)
+    {
+        const int n = balls.size();
+        const int side = 1 << QuadTree::split_levels;
+        const int cells = side * side;
+
+        tree.nodes.clear();
+        tree.order.resize(n);
+        tree.pos.resize(n);
+        tree.mass.resize(n);
+
+        if (n == 0)
+        {
+            return;
+        }
+
+        // square bounding box around every ball
+        Vector2 lo = balls[0].position, hi = balls[0].position;
+        for (int i = 1; i < n; ++i)
+        {
+            lo.x = std::min(lo.x, balls[i].position.x);
+            lo.y = std::min(lo.y, balls[i].position.y);
+            hi.x = std::max(hi.x, balls[i].position.x);
+            hi.y = std::max(hi.y, balls[i].position.y);
+        }
+
+        const float half = std::max(hi.x - lo.x, hi.y - lo.y) * 0.5f + 1.0f;
+        const Vector2 center = { (lo.x + hi.x) * 0.5f, (lo.y + hi.y) * 0.5f };
+        const Vector2 corner = { center.x - half, center.y - half };
+        const float cell_size = 2.0f * half / side;
+
+        // counting sort the balls into the side x side grid at the bottom of the serial levels
+        std::vector<int>& cell_of = tree.cell_of;
+        std::vector<int>& start = tree.start;
+        cell_of.resize(n);
+        start.assign(cells + 1, 0);
+
+        for (int i = 0; i < n; ++i)
+        {
+            int cx = std::clamp((int)((balls[i].position.x - corner.x) / cell_size), 0, side - 1);
+            int cy = std::clamp((int)((balls[i].position.y - corner.y) / cell_size), 0, side - 1);
+            cell_of[i] = cy * side + cx;
+            ++start[cell_of[i] + 1];
+        }
+
+        for (int c = 0; c < cells; ++c)
+        {
+            start[c + 1] += start[c];
+        }
+
+        std::vector<int>& fill = tree.fill;
+        fill.assign(start.begin(), start.end() - 1);
+        for (int i = 0; i < n; ++i)
+        {
+            int slot = fill[cell_of[i]]++;
+            tree.order[slot] = i;
+            tree.pos[slot] = balls[i].position;
+            tree.mass[slot] = BallMass(balls[i]);
+        }
+
+        // build each grid cell's subtree into its own node array
+        std::vector<std::vector<QuadNode>>& subtrees = tree.subtrees;
+        subtrees.resize(cells);
+
+        Parallel::For(0, cells, [&](int first, int last, int)
+        {
+            for (int c = first; c < last; ++c)
+            {
+                subtrees[c].clear();
+                if (start[c] == start[c + 1])
+                {
+                    continue;
+                }
+
+                Vector2 cell_center = { corner.x + ((c % side) + 0.5f) * cell_size, corner.y + ((c / side) + 0.5f) * cell_size };
+                BuildQuadNode(tree, subtrees[c], start[c], start[c + 1], cell_center, cell_size * 0.5f, QuadTree::split_levels);
+            }
+        }, 1);
+
+        // stitch them together under the serial levels, level by level from the bottom up
+        std::vector<int>& level = tree.level;
+        level.assign(cells, -1);
+
+        for (int c = 0; c < cells; ++c)
+        {
+            if (subtrees[c].empty())
+            {
+                continue;
+            }
+
+            const int offset = tree.nodes.size();
+            for (int i = 0; i < subtrees[c].size(); ++i)
+            {
+                QuadNode node = subtrees[c][i];
+                for (int k = 0; k < 4; ++k)
+                {
+                    if (node.child[k] >= 0)
+                    {
+                        node.child[k] += offset;
+                    }
+                }
+                tree.nodes.push_back(node);
+            }
+            level[c] = offset;
+        }
+
+        for (int s = side; s > 1; s /= 2)
+        {
+            const int parent_side = s / 2;
+            const float parent_half = half / parent_side;
+            std::vector<int>& parents = tree.parents;
+            parents.assign(parent_side * parent_side, -1);
+
+            for (int py = 0; py < parent_side; ++py)
+            {
+                for (int px = 0; px < parent_side; ++px)
+                {
+                    QuadNode node;
+                    node.center = Vector2{ corner.x + (px + 0.5f) * 2.0f * parent_half, corner.y + (py + 0.5f) * 2.0f * parent_half };
+                    node.half = parent_half;
+                    node.first = 0;
+                    node.count = 0;
+
+                    float m = 0.0f, cx = 0.0f, cy = 0.0f;
+                    for (int k = 0; k < 4; ++k)
+                    {
+                        int child = level[(py * 2 + (k >> 1)) * s + px * 2 + (k & 1)];
+                        node.child[k] = child;
+                        if (child >= 0)
+                        {
+                            m += tree.nodes[child].mass;
+                            cx += tree.nodes[child].mass * tree.nodes[child].com.x;
+                            cy += tree.nodes[child].mass * tree.nodes[child].com.y;
+                        }
+                    }
+
+                    node.mass = m;
+                    node.com = (m > 0.0f) ? Vector2{ cx / m, cy / m } : node.center;
+                    parents[py * parent_side + px] = tree.nodes.size();
+                    tree.nodes.push_back(node);
+                }
+            }
+
+            level.swap(parents);
+        }
+
+        // the root ended up last, swap it to the front so nodes[0] is always the root
+        const int root = level[0];
+        std::swap(tree.nodes[0], tree.nodes[root]);
+        for (int i = 0; i < tree.nodes.size(); ++i)
+        {
+            for (int k = 0; k < 4; ++k)
+            {
+                if (tree.nodes[i].child[k] == 0)
+                {
+                    tree.nodes[i].child[k] = root;
+                }
+                else if (tree.nodes[i].child[k] == root)
+                {
+                    tree.nodes[i].child[k] = 0;
+                }
+            }
+        }
+    }
+
+    // walks the tree for every ball and adds its gravitational pull to accel
+    inline void AddBarnesHutGravity(const NBodySettings& settings, const QuadTree& tree, const std::vector<Raylib::Circle>& balls, std::vector<Vector2>& accel)
+    {
+        if (tree.nodes.empty())
+        {
+            return;
+        }
+
+        const float theta2 = settings.theta * settings.theta;
+        const float soft2 = settings.softening * settings.softening;
+
+        Parallel::For(0, balls.size(), [&](int first, int last, int)
+        {
+            int stack[4 * QuadTree::max_depth + 8];
+
+            for (int i = first; i < last; ++i)
+            {
+                const Vector2 p = balls[i].position;
+                float ax = 0.0f, ay = 0.0f;
+                int top = 0;
+                stack[top++] = 0;
+
+                while (top > 0)
+                {
+                    const QuadNode& node = tree.nodes[stack[--top]];
+
+                    if (node.count > 0)
+                    {
+                        // leaf, sum its balls directly, except the ball itself
+                        for (int j = node.first; j < node.first + node.count; ++j)
+                        {
+                            if (tree.order[j] == i)
+                            {
+                                continue;
+                            }
+                            float dx = tree.pos[j].x - p.x;
+                            float dy = tree.pos[j].y - p.y;
+                            float r2 = dx * dx + dy * dy + soft2;
+                            float s = tree.mass[j] / (r2 * sqrtf(r2));
+                            ax += s * dx;
+                            ay += s * dy;
+                        }
+                        continue;
+                    }
+
+                    float dx = node.com.x - p.x;
+                    float dy = node.com.y - p.y;
+                    float d2 = dx * dx + dy * dy;
+                    float size = 2.0f * node.half;
+
+                    // never approximate a cell the ball is sitting in, its own mass would be in the sum
+                    bool inside = fabsf(p.x - node.center.x) <= node.half && fabsf(p.y - node.center.y) <= node.half;
+
+                    if (!inside && size * size < theta2 * d2)
+                    {
+                        // far enough away to treat as a single point mass
+                        float r2 = d2 + soft2;
+                        float s = node.mass / (r2 * sqrtf(r2));
+                        ax += s * dx;
+                        ay += s * dy;
+                    }
+                    else
+                    {
+                        for (int k = 0; k < 4; ++k)
+                        {
+                            if (node.child[k] >= 0)
+                            {
+                                stack[top++] = node.child[k];
+                            }
+                        }
+                    }
+                }
+
+                accel[i].x += settings.G * ax;
+                accel[i].y += settings.G * ay;
+            }
+        }, 64);
+    }
+
+    // exact reference, every ball against every other ball
+    template <typename Body, typename Vec>
+    void AddBruteForceGravity(const NBodySettings& settings, const std::vector<Body>& balls, std::vector<Vec>& accel)
+    {
+        const int n = balls.size();
+        const float soft2 = settings.softening * settings.softening;
+
+        Parallel::For(0, n, [&](int first, int last, int)
+        {
+            for (int i = first; i < last; ++i)
+            {
+                Vec a = {};
+
+                for (int j = 0; j < n; ++j)
+                {
+                    if (j == i)
+                    {
+                        continue;
+                    }
+                    Vec d = Position(balls[j]) - Position(balls[i]);
+                    float r2 = Dot(d, d) + soft2;
+                    a = a + d * (BallMass(balls[j]) / (r2 * sqrtf(r2)));
+                }
+
+                accel[i] = accel[i] + a * settings.G;
+            }
+        }, 16);
+    }
+
+    inline void AddNBodyGravity(const NBodySettings& settings, QuadTree& tree, const std::vector<Raylib::Circle>& balls, std::vector<Vector2>& accel)
+    {
+        if (!settings.enabled)
+        {
+            return;
+        }
+
+        if (settings.brute_force)
+        {
+            AddBruteForceGravity(settings, balls, accel);
+        }
+        else
+        {
+            BuildQuadTree(tree, balls);
+            AddBarnesHutGravity(settings, tree, balls, accel);
+        }
+    }
+
+    inline void AddNBodyGravity(const NBodySettings& settings, QuadTree& tree, const std::vector<Raylib::Sphere>& balls, std::vector<Vector3>& accel)
+    {
+        if (settings.enabled)
+        {
+            AddBruteForceGravity(settings, balls, accel);
+        }
+    }
+
+    // how far an approximation is from the reference, as relative errors of the acceleration vectors
+    typedef struct GravityError
+    {
+        float rms;
+        float max;
+
+    } GravityError;
+
+    inline GravityError CompareGravity(const std::vector<Vector2>& reference, const std::vector<Vector2>& approx)
+    {
+        GravityError err = { 0.0f, 0.0f };
+        double sum = 0.0;
+
+        for (int i = 0; i < reference.size(); ++i)
+        {
+            float ref = Vector2Length(reference[i]);
+            float rel = Vector2Length(approx[i] - reference[i]) / std::max(ref, 1e-12f);
+            sum += rel * rel;
+            err.max = std::max(err.max, rel);
+        }
+
+        if (!reference.empty())
+        {
+            err.rms = sqrt(sum / reference.size());
+        }
+
+        return err;
+    }
+};
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef PANEL_H
+#define PANEL_H
+
+#include "defs.h"
+#include "simulation.h"
+#include "config.h"
+
+#include <cmath>
+#include <string>
+#include <thread>
+
+// raygui side panel for tuning a running simulation, every control edits the config it was
+// loaded from and DrawControlPanel() says when something changed so the caller can hand the
+// config on, underneath it shows what each phase of a step is costing right now. Tab hides it
+
+namespace Graphics
+{
+    typedef struct ControlPanel
+    {
+        bool visible = true;
+        float width = 190.0f;
+
+        float log_balls;                // the ball count slider is log scaled, 1 to a million
+        float spawn_rate;
+        int threads;
+        int broadphase;                 // a Physics::BroadphaseType
+        int integrator;                 // index into Physics::integrator_names
+        int render;                     // 0 balls, 1 density
+
+        Physics::StepTimings smoothed;  // phase costs averaged over the last second or so
+
+    } ControlPanel;
+
+    // the controls start out showing the config
+    inline void SyncControlPanel(ControlPanel& panel, const Config::SimConfig& config, const int threads)
+    {
+        panel.log_balls = log10f(std::max(1, config.balls));
+        panel.spawn_rate = config.spawn_rate;
+        panel.threads = threads;
+        panel.broadphase = config.broadphase;
+        panel.render = config.render == "density" ? 1 : 0;
+
+        panel.integrator = 0;
+        for (int i = 0; i < Physics::integrator_count; ++i)
+        {
+            if (config.integrator == Physics::integrator_names[i])
+            {
+                panel.integrator = i;
+            }
+        }
+    }
+
+    inline bool PanelContainsMouse(const ControlPanel& panel)
+    {
+        return panel.visible && GetMousePosition().x >= GetScreenWidth() - panel.width;
+    }
+
+    // draws the panel, feeds the controls back into config and returns true if any of them moved.
+    // balls is how many there are right now, which lags the slider while they spawn
+    inline bool DrawControlPanel(ControlPanel& panel, Config::SimConfig& config, const Physics::StepTimings& timings, const int balls)
+    {
+        if (IsKeyPressed(KEY_TAB))
+        {
+            panel.visible = !panel.visible;
+        }
+
+        for (int p = 0; p < Physics::PHASE_COUNT; ++p)
+        {
+            panel.smoothed.ms[p] += (timings.ms[p] - panel.smoothed.ms[p]) * 0.05f;
+        }
+
+        if (!panel.visible)
+        {
+            return false;
+        }
+
+        const ControlPanel before = panel;
+        const float x = GetScreenWidth() - panel.width;
+        const float w = panel.width - 20.0f;
+        float y = 30.0f;
+
+        GuiPanel(::Rectangle{ x, 0.0f, panel.width, (float)GetScreenHeight() }, "Simulation");
+
+        const int target = (int)roundf(powf(10.0f, panel.log_balls));
+        GuiLabel(::Rectangle{ x + 10, y, w, 16 }, TextFormat("balls %i (now %i)", target, balls));
+        GuiSliderBar(::Rectangle{ x + 10, y + 16, w, 14 }, NULL, NULL, &panel.log_balls, 0.0f, 6.0f);
+        y += 40;
+
+        GuiLabel(::Rectangle{ x + 10, y, w, 16 }, TextFormat("spawn rate %i / s", (int)panel.spawn_rate));
+        GuiSliderBar(::Rectangle{ x + 10, y + 16, w, 14 }, NULL, NULL, &panel.spawn_rate, 0.0f, 100000.0f);
+        y += 40;
+
+        GuiLabel(::Rectangle{ x + 10, y, w, 16 }, "threads");
+        GuiSpinner(::Rectangle{ x + 10, y + 16, w, 18 }, NULL, &panel.threads, 1, std::max(1u, std::thread::hardware_concurrency()), false);
+        y += 44;
+
+        GuiLabel(::Rectangle{ x + 10, y, w, 16 }, "broadphase");
+        GuiToggleGroup(::Rectangle{ x + 10, y + 16, w / 3 - 1, 18 }, "grid;brute;sorted", &panel.broadphase);
+        y += 44;
+
+        GuiLabel(::Rectangle{ x + 10, y, w, 16 }, "integrator");
+        GuiToggleGroup(::Rectangle{ x + 10, y + 16, w / 2 - 1, 18 }, "euler;semi\nverlet;rk4", &panel.integrator);
+        y += 64;
+
+        GuiLabel(::Rectangle{ x + 10, y, w, 16 }, "render");
+        GuiToggleGroup(::Rectangle{ x + 10, y + 16, w / 2 - 1, 18 }, "balls;density", &panel.render);
+        y += 48;
+
+        // the phase costs as bars against the whole step
+        float total = 0.0f;
+        for (int p = 0; p < Physics::PHASE_COUNT; ++p)
+        {
+            total += panel.smoothed.ms[p];
+        }
+
+        GuiLine(::Rectangle{ x + 10, y, w, 12 }, TextFormat("step %.2f ms", total));
+        y += 16;
+
+        for (int p = 0; p < Physics::PHASE_COUNT; ++p)
+        {
+            float share = total > 0.0f ? panel.smoothed.ms[p] / total : 0.0f;
+            GuiLabel(::Rectangle{ x + 10, y, w, 14 }, TextFormat("%s %.3f ms", Physics::phase_names[p], panel.smoothed.ms[p]));
+            GuiProgressBar(::Rectangle{ x + 10, y + 14, w, 6 }, NULL, NULL, &share, 0.0f, 1.0f);
+            y += 24;
+        }
+
+        const bool changed = panel.log_balls != before.log_balls || panel.spawn_rate != before.spawn_rate || panel.threads != before.threads ||
+                             panel.broadphase != before.broadphase || panel.integrator != before.integrator || panel.render != before.render;
+
+        // back into the config, only when touched so a slider never rounds away what the config said
+        if (changed)
+        {
+            config.balls = (int)roundf(powf(10.0f, panel.log_balls));
+            config.spawn_rate = panel.spawn_rate;
+            config.threads = panel.threads;
+            config.broadphase = (Physics::BroadphaseType)panel.broadphase;
+            config.integrator = Physics::integrator_names[panel.integrator];
+            config.render = panel.render == 1 ? "density" : "balls";
+        }
+        return changed;
+    }
+};
+
+#endif
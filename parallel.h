@@ -0,0 +1,722 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "memory.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <cassert>
+
+// a persistent work stealing scheduler so the physics can split big loops across cores without
+// paying for thread creation every frame, and a triple buffer for handing snapshots from the
+// simulation thread to the render thread.
+//
+// Every worker has a Chase-Lev deque of tasks: it pushes and pops its own work at the bottom and
+// anyone with nothing to do steals from the top of someone else's. A loop is cut into a few pieces
+// per thread instead of one fixed piece each, so when some pieces are heavier than others (dense
+// grid cells, deep tree walks) whoever finishes early takes over what's left. Loops inside tasks
+// push their pieces onto the same deques, and anything waiting for its pieces runs other tasks
+// meanwhile instead of blocking.
+//
+// Threads outside the pool (the simulation thread, the render thread) each get a slot of their
+// own while they hand out work, so they can do it at the same time. Every task remembers which
+// slot it came from (its root), and a thread that's waiting only helps with tasks from the same
+// root, so the render thread never ends up running a piece of the physics or the other way round
+
+namespace Parallel
+{
+    typedef struct Task
+    {
+        void (*run)(struct Task& task, int worker);
+        const void* data;                   // whatever run() needs, it outlives the task
+        int start, stop;
+        std::atomic<int>* pending;          // counted down once it's done, the spawner waits for 0
+        int tag;                            // the spawner's Memory tag, so allocations in it count against the right subsystem
+        // read by CanHelp() before the task is taken, when it might still be getting filled in
+        std::atomic<int> root;                  // the slot of the outside thread whose work this is
+        std::atomic<const void*> loop;          // the For() it's a piece of, nullptr for graph jobs
+
+        // only used in a TaskGraph, tasks that can't start until this one is done
+        static constexpr int max_successors = 4;
+        struct Task* successors[max_successors];
+        int successor_count;
+        int predecessor_count;
+        std::atomic<int> waiting;           // predecessors still running
+
+    } Task;
+
+    // the Chase-Lev deque (with the C11 orderings from Le et al.), fixed size, a full one makes
+    // the caller run the task itself instead of growing
+    typedef struct TaskDeque
+    {
+        static constexpr long capacity = 1024;
+
+        std::atomic<long> top{ 0 };
+        std::atomic<long> bottom{ 0 };
+        std::atomic<Task*> tasks[capacity];
+
+    } TaskDeque;
+
+    // owner only
+    inline bool PushTask(TaskDeque& deque, Task* task)
+    {
+        const long b = deque.bottom.load(std::memory_order_relaxed);
+        const long t = deque.top.load(std::memory_order_acquire);
+        if (b - t >= TaskDeque::capacity)
+        {
+            return false;
+        }
+
+        deque.tasks[b & (TaskDeque::capacity - 1)].store(task, std::memory_order_relaxed);
+        deque.bottom.store(b + 1, std::memory_order_release);        // the task's fields go out with it
+        return true;
+    }
+
+    // owner only, newest first
+    inline Task* PopTask(TaskDeque& deque)
+    {
+        const long b = deque.bottom.load(std::memory_order_relaxed) - 1;
+        deque.bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = deque.top.load(std::memory_order_relaxed);
+
+        if (t > b)
+        {
+            deque.bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        Task* task = deque.tasks[b & (TaskDeque::capacity - 1)].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // the last one, a thief might be after it too
+            if (!deque.top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                task = nullptr;
+            }
+            deque.bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    // owner only, what PopTask() would return without taking it
+    inline Task* PeekTask(TaskDeque& deque)
+    {
+        const long b = deque.bottom.load(std::memory_order_relaxed) - 1;
+        const long t = deque.top.load(std::memory_order_acquire);
+        if (t > b)
+        {
+            return nullptr;
+        }
+        return deque.tasks[b & (TaskDeque::capacity - 1)].load(std::memory_order_relaxed);
+    }
+
+    struct Worker;
+    inline bool CanHelp(const struct Worker& self, const Task& task);
+
+    // anyone, oldest first, nullptr if it's empty or another thief got there first. A thread that's
+    // waiting passes itself as helper and leaves tasks it can't help with where they are
+    inline Task* StealTask(TaskDeque& deque, const struct Worker* helper = nullptr)
+    {
+        long t = deque.top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const long b = deque.bottom.load(std::memory_order_acquire);
+
+        if (t >= b)
+        {
+            return nullptr;
+        }
+
+        Task* task = deque.tasks[t & (TaskDeque::capacity - 1)].load(std::memory_order_relaxed);
+        if (helper != nullptr && !CanHelp(*helper, *task))
+        {
+            return nullptr;
+        }
+        if (!deque.top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        return task;
+    }
+
+    typedef struct Worker
+    {
+        static constexpr int arena_size = 1024;
+        static constexpr int max_depth = 32;
+
+        TaskDeque deque;
+        Task arena[arena_size];     // tasks this worker spawned, used like a stack since whoever spawns waits for them
+        int arena_top = 0;
+        unsigned steal_seed;
+
+        int root = -1;                                  // whose task it's running, -1 when it's idle
+        const void* loops[max_depth];                   // the For()s it's running a piece of
+        int depth = 0;
+        std::atomic<bool> claimed{ false };             // outside slots only, taken while a thread hands out work through it
+
+    } Worker;
+
+    // a thread waiting for its own tasks runs something else meanwhile, but only work from the same
+    // root, and never a second piece of a loop it's already in the middle of a piece of (that piece
+    // would get the same worker id, and loops use it to pick their scratch)
+    inline bool CanHelp(const Worker& self, const Task& task)
+    {
+        if (task.root.load(std::memory_order_relaxed) != self.root)
+        {
+            return false;
+        }
+        const void* loop = task.loop.load(std::memory_order_relaxed);
+        for (int d = 0; d < self.depth; ++d)
+        {
+            if (self.loops[d] == loop)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    typedef struct Scheduler
+    {
+        static constexpr int outside_slots = 4;     // outside threads that can hand out work at once
+
+        std::vector<std::unique_ptr<Worker>> workers;       // the outside slots first, then the pool
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::mutex gate;                    // SetThreadCount() holds it so new work waits rather than starving it
+        std::shared_mutex running;          // shared by everyone handing out work, SetThreadCount() takes it whole
+        std::condition_variable wake;
+        unsigned long epoch = 0;            // bumped whenever there's new work, so sleepers know to look
+        bool quit = false;
+        std::atomic<int> arena_peak{ 0 };   // the most of any worker's arena ever used at once
+
+        void Stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                quit = true;
+            }
+            wake.notify_all();
+
+            for (int t = 0; t < threads.size(); ++t)
+            {
+                threads[t].join();
+            }
+            threads.clear();
+            quit = false;
+        }
+
+        ~Scheduler() { Stop(); }
+
+    } Scheduler;
+
+    inline Scheduler scheduler;
+    inline std::atomic<int> thread_count{ 1 };
+    inline thread_local int current_worker = -1;   // which Worker this thread is while it's running tasks
+
+    inline void RunTask(Task& task, const int worker);
+
+    // something to do from anywhere, this worker's own deque first. A helping worker only takes
+    // what it can help with, the newest task on its own deque being one it can't means none of
+    // the ones above it are left
+    inline Task* FindTask(const int worker, const bool helping = false)
+    {
+        Worker& self = *scheduler.workers[worker];
+
+        Task* task = nullptr;
+        if (!helping)
+        {
+            task = PopTask(self.deque);
+        }
+        else
+        {
+            Task* newest = PeekTask(self.deque);
+            task = (newest != nullptr && CanHelp(self, *newest)) ? PopTask(self.deque) : nullptr;
+        }
+
+        const int count = scheduler.workers.size();
+        for (int attempt = 0; task == nullptr && attempt < count; ++attempt)
+        {
+            self.steal_seed = self.steal_seed * 1664525u + 1013904223u;
+            const int victim = (self.steal_seed >> 16) % count;
+            if (victim != worker)
+            {
+                task = StealTask(scheduler.workers[victim]->deque, helping ? &self : nullptr);
+            }
+        }
+        return task;
+    }
+
+    inline void WakeWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock(scheduler.mutex);
+            ++scheduler.epoch;
+        }
+        scheduler.wake.notify_all();
+    }
+
+    // on the worker's own deque, or straight away if that's full
+    inline void SpawnTask(Task& task, const int worker)
+    {
+        if (!PushTask(scheduler.workers[worker]->deque, &task))
+        {
+            RunTask(task, worker);
+        }
+    }
+
+    // runs other tasks it can help with until pending gets to 0, never sleeps since it's usually very soon
+    inline void HelpUntilDone(std::atomic<int>& pending, const int worker)
+    {
+        while (pending.load(std::memory_order_acquire) > 0)
+        {
+            Task* task = FindTask(worker, true);
+            if (task != nullptr)
+            {
+                RunTask(*task, worker);
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    inline void RunTask(Task& task, const int worker)
+    {
+        Worker& self = *scheduler.workers[worker];
+        const int root = self.root;
+        const void* loop = task.loop.load(std::memory_order_relaxed);
+        self.root = task.root.load(std::memory_order_relaxed);
+        if (loop != nullptr)
+        {
+            assert(self.depth < Worker::max_depth);
+            self.loops[self.depth++] = loop;
+        }
+
+        {
+            Memory::MemoryScope memory(task.tag);
+            task.run(task, worker);
+        }
+
+        if (loop != nullptr)
+        {
+            --self.depth;
+        }
+        self.root = root;
+
+        // graph tasks hand their successors on once everything before them is done
+        bool spawned = false;
+        for (int s = 0; s < task.successor_count; ++s)
+        {
+            if (task.successors[s]->waiting.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                SpawnTask(*task.successors[s], worker);
+                spawned = true;
+            }
+        }
+        if (spawned)
+        {
+            WakeWorkers();
+        }
+
+        task.pending->fetch_sub(1, std::memory_order_release);
+    }
+
+    inline void WorkerLoop(const int worker)
+    {
+        current_worker = worker;
+        unsigned long seen = 0;
+
+        while (true)
+        {
+            Task* task = FindTask(worker);
+
+            // a little spinning first, the next loop of a step usually isn't far behind
+            for (int spin = 0; task == nullptr && spin < 64; ++spin)
+            {
+                std::this_thread::yield();
+                task = FindTask(worker);
+            }
+
+            if (task != nullptr)
+            {
+                RunTask(*task, worker);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(scheduler.mutex);
+            if (scheduler.quit)
+            {
+                return;
+            }
+            if (scheduler.epoch == seen)
+            {
+                scheduler.wake.wait(lock);
+            }
+            seen = scheduler.epoch;
+        }
+    }
+
+    // whoever hands out the work computes too, so the pool is one thread short of num_threads
+    inline void StartWorkers(const int num_threads)
+    {
+        scheduler.Stop();
+
+        const int count = Scheduler::outside_slots + num_threads - 1;
+        scheduler.workers.clear();
+        for (int w = 0; w < count; ++w)
+        {
+            scheduler.workers.push_back(std::unique_ptr<Worker>(new Worker()));
+            scheduler.workers[w]->steal_seed = 12345u + 7919u * w;
+        }
+
+        for (int w = Scheduler::outside_slots; w < count; ++w)
+        {
+            scheduler.threads.push_back(std::thread(WorkerLoop, w));
+        }
+    }
+
+    // safe to call while other threads have work running, it waits for that to finish first
+    inline void SetThreadCount(int n)
+    {
+        if (n <= 0)
+        {
+            n = std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        std::lock_guard<std::mutex> gate(scheduler.gate);
+        std::unique_lock<std::shared_mutex> lock(scheduler.running);
+        if (n != thread_count || scheduler.workers.empty())
+        {
+            thread_count = n;
+            StartWorkers(n);
+        }
+    }
+
+    inline int ThreadCount() { return thread_count; }
+
+    // how many worker ids there can be, the pool and a slot for each outside thread
+    inline int WorkerCount() { return Scheduler::outside_slots + thread_count - 1; }
+
+    inline int TaskArenaPeak() { return scheduler.arena_peak.load(std::memory_order_relaxed); }
+
+    // a thread that isn't one of the workers takes a free outside slot while it hands out work,
+    // and the work it hands out has that slot as its root. Only when all of them are taken does
+    // it wait for one
+    typedef struct WorkerScope
+    {
+        std::shared_lock<std::shared_mutex> lock;
+        int worker;
+
+        WorkerScope() : worker(current_worker)
+        {
+            if (worker >= 0)
+            {
+                return;
+            }
+
+            while (true)
+            {
+                {
+                    std::lock_guard<std::mutex> gate(scheduler.gate);
+                    lock = std::shared_lock<std::shared_mutex>(scheduler.running);
+                }
+                if (!scheduler.workers.empty())
+                {
+                    break;
+                }
+                lock.unlock();
+                SetThreadCount(thread_count);
+            }
+
+            for (int slot = 0; worker < 0; slot = (slot + 1) % Scheduler::outside_slots)
+            {
+                Worker& self = *scheduler.workers[slot];
+                if (!self.claimed.load(std::memory_order_relaxed) && !self.claimed.exchange(true, std::memory_order_acquire))
+                {
+                    worker = slot;
+                }
+                else if (slot == Scheduler::outside_slots - 1)
+                {
+                    std::this_thread::yield();
+                }
+            }
+
+            scheduler.workers[worker]->root = worker;
+            current_worker = worker;
+        }
+
+        ~WorkerScope()
+        {
+            if (lock.owns_lock())
+            {
+                scheduler.workers[worker]->root = -1;
+                scheduler.workers[worker]->claimed.store(false, std::memory_order_release);
+                current_worker = -1;
+            }
+        }
+
+    } WorkerScope;
+
+    template <typename Fn>
+    struct ForPiece
+    {
+        static void Run(Task& task, int worker)
+        {
+            (*(const Fn*)task.data)(task.start, task.stop, worker);
+        }
+    };
+
+    // splits [begin, end) into pieces and calls fn(start, stop, worker) on each, where worker is
+    // below WorkerCount() and says which thread is running it (one thread can get several pieces,
+    // but never two of the same loop at once). Small ranges aren't worth waking anyone for so they
+    // run on the caller, otherwise there are up to 4 pieces per thread of at least min_per_thread each
+    template <typename Fn>
+    void For(int begin, int end, Fn fn, int min_per_thread = 256)
+    {
+        const int count = end - begin;
+        if (count <= 0)
+        {
+            return;
+        }
+
+        WorkerScope scope;
+        const int pieces = std::min(thread_count * 4, count / std::max(1, min_per_thread));
+
+        if (pieces <= 1 || thread_count <= 1)
+        {
+            fn(begin, end, scope.worker);
+            return;
+        }
+
+        Worker& self = *scheduler.workers[scope.worker];
+
+        if (self.arena_top + pieces > Worker::arena_size)
+        {
+            fn(begin, end, scope.worker);
+            return;
+        }
+
+        std::atomic<int> pending{ pieces };
+        Task* tasks = self.arena + self.arena_top;
+        self.arena_top += pieces;
+
+        int peak = scheduler.arena_peak.load(std::memory_order_relaxed);
+        while (self.arena_top > peak && !scheduler.arena_peak.compare_exchange_weak(peak, self.arena_top, std::memory_order_relaxed))
+        {
+        }
+
+        // pushed last piece first so the owner pops them in order and thieves take from the end
+        for (int p = pieces - 1; p >= 0; --p)
+        {
+            Task& task = tasks[p];
+            task.run = &ForPiece<Fn>::Run;
+            task.data = &fn;
+            task.start = begin + (long)count * p / pieces;
+            task.stop = begin + (long)count * (p + 1) / pieces;
+            task.pending = &pending;
+            task.tag = Memory::current_tag;
+            task.root.store(self.root, std::memory_order_relaxed);
+            task.loop.store(&pending, std::memory_order_relaxed);
+            task.successor_count = 0;
+
+            if (p > 0)
+            {
+                SpawnTask(task, scope.worker);
+            }
+        }
+        WakeWorkers();
+
+        RunTask(tasks[0], scope.worker);
+        HelpUntilDone(pending, scope.worker);
+
+        self.arena_top -= pieces;
+    }
+
+    // a handful of jobs with an order between some of them, built and run again every time (it
+    // doesn't allocate once it's been used). Jobs that don't depend on each other run at once,
+    // and loops inside any of them spread over the workers like anywhere else
+    typedef struct TaskGraph
+    {
+        static constexpr int max_tasks = 16;
+
+        Task tasks[max_tasks];
+        int count = 0;
+
+    } TaskGraph;
+
+    template <typename Fn>
+    struct GraphJob
+    {
+        static void Run(Task& task, int)
+        {
+            (*(const Fn*)task.data)();
+        }
+    };
+
+    inline void ClearGraph(TaskGraph& graph)
+    {
+        graph.count = 0;
+    }
+
+    // fn() has to stay alive until RunGraph() returns, returns the job's index for Precede()
+    template <typename Fn>
+    int AddJob(TaskGraph& graph, const Fn& fn)
+    {
+        assert(graph.count < TaskGraph::max_tasks);
+        Task& task = graph.tasks[graph.count];
+        task.run = &GraphJob<Fn>::Run;
+        task.data = &fn;
+        task.tag = Memory::current_tag;
+        task.loop.store(nullptr, std::memory_order_relaxed);
+        task.successor_count = 0;
+        task.predecessor_count = 0;
+        return graph.count++;
+    }
+
+    // job `before` has to finish before job `after` starts
+    inline void Precede(TaskGraph& graph, const int before, const int after)
+    {
+        assert(before >= 0 && before < graph.count && after >= 0 && after < graph.count);
+        Task& task = graph.tasks[before];
+        assert(task.successor_count < Task::max_successors);
+        task.successors[task.successor_count++] = &graph.tasks[after];
+        ++graph.tasks[after].predecessor_count;
+    }
+
+    inline void RunGraph(TaskGraph& graph)
+    {
+        WorkerScope scope;
+        std::atomic<int> pending{ graph.count };
+
+        for (int t = 0; t < graph.count; ++t)
+        {
+            graph.tasks[t].pending = &pending;
+            graph.tasks[t].root.store(scheduler.workers[scope.worker]->root, std::memory_order_relaxed);
+            graph.tasks[t].waiting.store(graph.tasks[t].predecessor_count, std::memory_order_relaxed);
+        }
+
+        for (int t = graph.count - 1; t >= 0; --t)
+        {
+            if (graph.tasks[t].predecessor_count == 0)
+            {
+                SpawnTask(graph.tasks[t], scope.worker);
+            }
+        }
+        WakeWorkers();
+
+        HelpUntilDone(pending, scope.worker);
+    }
+
+    // for loops that find things rather than update them, fn(start, stop, out) appends whatever it
+    // finds in [start, stop) to out. The range is cut into a few chunks per thread and every chunk
+    // gets its own buffer, so nothing is shared while it runs, then the buffers are joined into result
+    // in chunk order (each one copied to the sum of the sizes before it), which makes result exactly
+    // what a single thread would have found. buffers is scratch to keep between calls
+    template <typename T, typename Fn>
+    void Collect(int begin, int end, std::vector<std::vector<T>>& buffers, std::vector<T>& result, Fn fn, int min_per_chunk = 256)
+    {
+        const int count = end - begin;
+        const int chunks = std::max(1, std::min(thread_count * 4, count / std::max(1, min_per_chunk)));
+
+        result.clear();
+        if (chunks == 1)
+        {
+            fn(begin, end, result);
+            return;
+        }
+
+        if (buffers.size() < chunks)
+        {
+            buffers.resize(chunks);
+        }
+
+        For(0, chunks, [&](int c_begin, int c_end, int)
+        {
+            for (int c = c_begin; c < c_end; ++c)
+            {
+                buffers[c].clear();
+                fn(begin + (int)((long)count * c / chunks), begin + (int)((long)count * (c + 1) / chunks), buffers[c]);
+            }
+        }, 1);
+
+        int total = 0;
+        for (int c = 0; c < chunks; ++c)
+        {
+            total += buffers[c].size();
+        }
+        result.resize(total);
+
+        For(0, chunks, [&](int c_begin, int c_end, int)
+        {
+            int offset = 0;
+            for (int c = 0; c < c_begin; ++c)
+            {
+                offset += buffers[c].size();
+            }
+
+            for (int c = c_begin; c < c_end; ++c)
+            {
+                std::copy(buffers[c].begin(), buffers[c].end(), result.begin() + offset);
+                offset += buffers[c].size();
+            }
+        }, 1);
+    }
+
+    // one writer and one reader swapping whole snapshots without ever blocking each other, the writer
+    // fills its back buffer and publishes it, the reader picks up the newest published one whenever it
+    // likes. The third buffer sits in the middle so neither side ever waits for the other to finish
+    template <typename T>
+    struct TripleBuffer
+    {
+        static constexpr int fresh = 4;     // set in middle when it holds something the reader hasn't seen
+
+        T buffers[3];
+        std::atomic<int> middle{ 2 };
+        int back = 0;       // only touched by the writer
+        int front = 1;      // only touched by the reader
+    };
+
+    // where the writer builds the next snapshot
+    template <typename T>
+    T& WriteBuffer(TripleBuffer<T>& tb)
+    {
+        return tb.buffers[tb.back];
+    }
+
+    // hands the back buffer over, and takes whatever was in the middle as the new back buffer
+    template <typename T>
+    void Publish(TripleBuffer<T>& tb)
+    {
+        tb.back = tb.middle.exchange(tb.back | TripleBuffer<T>::fresh, std::memory_order_acq_rel) & 3;
+    }
+
+    // swaps in the newest snapshot if there is one, returns false if nothing new was published
+    template <typename T>
+    bool Acquire(TripleBuffer<T>& tb)
+    {
+        if ((tb.middle.load(std::memory_order_relaxed) & TripleBuffer<T>::fresh) == 0)
+        {
+            return false;
+        }
+
+        tb.front = tb.middle.exchange(tb.front, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+
+    // the newest snapshot the reader has acquired, it stays put until the next Acquire()
+    template <typename T>
+    T& ReadBuffer(TripleBuffer<T>& tb)
+    {
+        return tb.buffers[tb.front];
+    }
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "defs.h"
+#include "dimension.h"
+#include "simulation.h"
+
+#include <vector>
+#include <string>
+#include <sstream>
+
+// balls coming and going while the simulation runs. Storage stays dense: a new ball goes on the
+// end and a removed one has the last ball moved into its slot (swap remove), so nothing ever
+// shifts, and the grid and handle table (handles.h) get patched for both instead of rebuilt.
+// Spawners add balls at a steady rate, sinks remove any ball whose centre gets inside them
+
+namespace Physics
+{
+    typedef struct Spawner
+    {
+        Vector3 position;       // 2D ignores z
+        Vector3 velocity;
+        float rate;             // balls a second
+        float spread;           // random extra velocity, up to this much on each axis
+        float budget = 0.0f;    // part of a ball left over from the last step
+
+    } Spawner;
+
+    typedef struct Sink
+    {
+        Vector3 position;
+        float radius;
+
+    } Sink;
+
+    // the new ball is always at the end, the handle keeps finding it after that
+    template <int D>
+    BallHandle AddBall(Simulation<D>& sim, const typename Dimension<D>::Body& ball)
+    {
+        SyncHandles(sim.handles, sim.balls.size());
+
+        sim.balls.push_back(ball);
+        GridAdd(sim.grid, sim.balls);
+        sim.integrator.accel_valid = false;         // Verlet has no acceleration saved for it
+        return CreateHandle(sim.handles, sim.balls.size() - 1);
+    }
+
+    // the last ball takes over index i, so when removing several go from the highest index down
+    template <int D>
+    void RemoveBall(Simulation<D>& sim, const int i)
+    {
+        SyncHandles(sim.handles, sim.balls.size());
+        SwapRemoveHandle(sim.handles, i);
+
+        GridSwapRemove(sim.grid, i);
+        sim.balls[i] = sim.balls.back();
+        sim.balls.pop_back();
+        sim.integrator.accel_valid = false;
+    }
+
+    // false if it was already gone
+    template <int D>
+    bool RemoveBall(Simulation<D>& sim, const BallHandle& handle)
+    {
+        SyncHandles(sim.handles, sim.balls.size());
+
+        const int i = ResolveHandle(sim.handles, handle);
+        if (i < 0)
+        {
+            return false;
+        }
+
+        RemoveBall(sim, i);
+        return true;
+    }
+
+    // the ball under a point (the closest one if a few overlap it), an empty handle if there's none
+    template <int D>
+    BallHandle FindBallAt(Simulation<D>& sim, const typename Dimension<D>::Vec& point)
+    {
+        typedef typename Dimension<D>::Vec Vec;
+
+        SyncHandles(sim.handles, sim.balls.size());
+
+        int best = -1;
+        float best_dist2 = 0.0f;
+        for (int i = 0; i < sim.balls.size(); ++i)
+        {
+            const Vec d = Position(sim.balls[i]) - point;
+            const float dist2 = Dot(d, d);
+            if (dist2 < sim.balls[i].radius * sim.balls[i].radius && (best < 0 || dist2 < best_dist2))
+            {
+                best = i;
+                best_dist2 = dist2;
+            }
+        }
+
+        return best < 0 ? BallHandle() : HandleOf(sim.handles, best);
+    }
+
+    // make_ball(spawner) builds each new ball, returns how many were added
+    template <int D, typename MakeBall>
+    int RunSpawners(Simulation<D>& sim, std::vector<Spawner>& spawners, const float dt, MakeBall make_ball)
+    {
+        int added = 0;
+
+        for (int s = 0; s < spawners.size(); ++s)
+        {
+            spawners[s].budget += spawners[s].rate * dt;
+
+            for (; spawners[s].budget >= 1.0f; spawners[s].budget -= 1.0f)
+            {
+                AddBall(sim, make_ball(spawners[s]));
+                ++added;
+            }
+        }
+        return added;
+    }
+
+    // returns how many were removed
+    template <int D>
+    int RunSinks(Simulation<D>& sim, const std::vector<Sink>& sinks)
+    {
+        typedef typename Dimension<D>::Vec Vec;
+
+        if (sinks.empty())
+        {
+            return 0;
+        }
+
+        int removed = 0;
+
+        // backwards, so the ball swapped into a removed slot has already been checked
+        for (int i = sim.balls.size() - 1; i >= 0; --i)
+        {
+            for (int s = 0; s < sinks.size(); ++s)
+            {
+                const Vec d = Position(sim.balls[i]) - FromVector3<Vec>(sinks[s].position);
+                if (Dot(d, d) < sinks[s].radius * sinks[s].radius)
+                {
+                    RemoveBall(sim, i);
+                    ++removed;
+                    break;
+                }
+            }
+        }
+        return removed;
+    }
+
+    // "spawner <x> <y> <rate> [vx] [vy] [spread]", false if the line is something else
+    inline bool ParseSpawner(const std::string& line, Spawner& spawner)
+    {
+        std::istringstream in(line);
+        std::string name;
+
+        if (!(in >> name) || name != "spawner")
+        {
+            return false;
+        }
+
+        spawner = Spawner{ { 0.0f, 0.0f, 0.0f }, { 0.0f, 0.0f, 0.0f }, 0.0f, 0.0f };
+        if (!(in >> spawner.position.x >> spawner.position.y >> spawner.rate))
+        {
+            return false;
+        }
+        in >> spawner.velocity.x >> spawner.velocity.y >> spawner.spread;       // optional
+        return true;
+    }
+
+    // "sink <x> <y> <radius>"
+    inline bool ParseSink(const std::string& line, Sink& sink)
+    {
+        std::istringstream in(line);
+        std::string name;
+
+        if (!(in >> name) || name != "sink")
+        {
+            return false;
+        }
+
+        sink = Sink{ { 0.0f, 0.0f, 0.0f }, 0.0f };
+        return (bool)(in >> sink.position.x >> sink.position.y >> sink.radius);
+    }
+};
+
+#endif
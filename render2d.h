@@ -0,0 +1,278 @@
+#ifndef RENDER2D_H
+#define RENDER2D_H
+
+#include "defs.h"
+#include "canvas.h"
+#include "meshcache.h"
+#include "render3d.h"
+#include "density.h"
+
+#include <vector>
+#include <unordered_map>
+#include <cmath>
+
+// batched 2D circles with level of detail. Every ball is tessellated with just enough segments for
+// its size on screen (a 3 pixel ball doesn't need the 36 DrawCircle() gives it), balls smaller than
+// a few pixels skip triangles altogether and go out as instanced quads the fragment shader cuts into
+// discs, and anything off screen is skipped before it costs a vertex
+
+namespace Graphics
+{
+    inline const char* disc_vs = R"(
+        #version 330
+        layout(location = 0) in vec3 vertexPosition;       // quad corner, -1 to 1
+        layout(location = 9) in vec3 instanceDisc;         // xy centre, z radius
+        layout(location = 10) in vec4 instanceColor;
+        uniform mat4 mvp;
+        out vec2 fragLocal;
+        out float fragRadius;
+        out vec4 fragColor;
+
+        void main()
+        {
+            fragLocal = vertexPosition.xy;
+            fragRadius = instanceDisc.z;
+            fragColor = instanceColor;
+            gl_Position = mvp * vec4(instanceDisc.xy + vertexPosition.xy * instanceDisc.z, 0.0, 1.0);
+        }
+    )";
+
+    inline const char* disc_fs = R"(
+        #version 330
+        in vec2 fragLocal;
+        in float fragRadius;
+        in vec4 fragColor;
+        uniform float pixelSize;        // world units per screen pixel
+        uniform vec4 outlineColor;
+        out vec4 finalColor;
+
+        void main()
+        {
+            float d = length(fragLocal);
+            if (d > 1.0) discard;
+
+            // the outline is one pixel wide, same as DrawCircleLines(), once the disc is big enough to show it
+            float radius_px = fragRadius / pixelSize;
+            bool rim = radius_px > 1.5 && (1.0 - d) * radius_px < 1.0;
+            finalColor = rim ? outlineColor : fragColor;
+        }
+    )";
+
+    typedef struct DiscInstance
+    {
+        Vector3 disc;           // xy centre, z radius
+        Color color;
+
+    } DiscInstance;
+
+    // a ball big enough for triangles, everything the fill and the outline need looked up once
+    typedef struct TessellatedCircle
+    {
+        Vector2 centre;
+        float radius;
+        Color color;
+        const std::vector<Vector2>* unit;
+
+    } TessellatedCircle;
+
+    typedef struct CircleStats
+    {
+        int drawn;              // tessellated
+        int discs;              // too small for triangles
+        int culled;
+        int vertices;           // sent through the rlgl batch
+
+    } CircleStats;
+
+    typedef struct CircleRenderer
+    {
+        Shader disc_shader;
+        int mvp_loc;
+        int pixel_size_loc;
+        int outline_loc;
+        InstancedMesh quad;
+        std::vector<DiscInstance> discs;
+        std::vector<TessellatedCircle> circles;
+
+        float disc_pixels = 3.0f;       // balls with a smaller on screen radius than this become discs
+        std::unordered_map<int, std::vector<Vector2>> unit_circles;     // by segment count
+        CircleStats stats;
+
+    } CircleRenderer;
+
+    inline void LoadCircleRenderer(CircleRenderer& renderer)
+    {
+        renderer.disc_shader = LoadShaderFromMemory(disc_vs, disc_fs);
+        renderer.mvp_loc = GetShaderLocation(renderer.disc_shader, "mvp");
+        renderer.pixel_size_loc = GetShaderLocation(renderer.disc_shader, "pixelSize");
+        renderer.outline_loc = GetShaderLocation(renderer.disc_shader, "outlineColor");
+
+        std::vector<InstanceAttribute> attributes = {
+            { 9, 3, RL_FLOAT, (int)offsetof(DiscInstance, disc) },
+            { 10, 4, RL_UNSIGNED_BYTE, (int)offsetof(DiscInstance, color) }
+        };
+
+        float corners[] = { -1, -1, 0,  -1, 1, 0,  1, 1, 0,  -1, -1, 0,  1, 1, 0,  1, -1, 0 };
+        Mesh mesh = {};
+        mesh.vertexCount = 6;
+        mesh.vertices = corners;
+        LoadInstancedMesh(renderer.quad, mesh, attributes, sizeof(DiscInstance));
+    }
+
+    inline void UnloadCircleRenderer(CircleRenderer& renderer)
+    {
+        UnloadInstancedMesh(renderer.quad);
+        UnloadShader(renderer.disc_shader);
+    }
+
+    // sin / cos around the circle for a segment count, worked out once and kept
+    inline const std::vector<Vector2>& UnitCircle(CircleRenderer& renderer, int segments)
+    {
+        std::vector<Vector2>& points = renderer.unit_circles[segments];
+        if (points.empty())
+        {
+            const float step = 2.0f * PI / segments;
+            for (int i = 0; i <= segments; ++i)
+            {
+                points.push_back(Vector2{ sinf(i * step), cosf(i * step) });
+            }
+        }
+        return points;
+    }
+
+    // draws every ball filled with an outline, call inside BeginMode2D(camera)
+    template <typename Ball>
+    void DrawCircles(CircleRenderer& renderer, const Camera2D& camera, const std::vector<Ball>& balls, const Color& outline)
+    {
+        renderer.stats = CircleStats{ 0, 0, 0, 0 };
+        renderer.discs.clear();
+        renderer.circles.clear();
+
+        // what the camera can see, in world units
+        const Vector2 view_min = GetScreenToWorld2D(Vector2{ 0.0f, 0.0f }, camera);
+        const Vector2 view_max = GetScreenToWorld2D(Vector2{ (float)GetRenderWidth(), (float)GetRenderHeight() }, camera);
+        const float zoom = camera.zoom;
+
+        // sort the balls into discs and circles first, the segment count and its unit circle
+        // are looked up here once a ball rather than once for the fill and again for the outline
+        int last_segments = -1;
+        const std::vector<Vector2>* last_unit = NULL;
+        for (int i = 0; i < balls.size(); ++i)
+        {
+            const Vector2 c = balls[i].position;
+            const float r = balls[i].radius;
+
+            if (c.x + r < view_min.x || c.x - r > view_max.x || c.y + r < view_min.y || c.y - r > view_max.y)
+            {
+                ++renderer.stats.culled;
+                continue;
+            }
+
+            const float screen_radius = r * zoom;
+            if (screen_radius < renderer.disc_pixels)
+            {
+                renderer.discs.push_back(DiscInstance{ Vector3{ c.x, c.y, r }, balls[i].color });
+                continue;
+            }
+
+            const int segments = EllipseSegments(screen_radius);
+            if (segments != last_segments)
+            {
+                last_segments = segments;
+                last_unit = &UnitCircle(renderer, segments);
+            }
+            renderer.circles.push_back(TessellatedCircle{ c, r, balls[i].color, last_unit });
+        }
+
+        // every fill as one run of triangles then every outline as one run of lines, so the batch
+        // keeps a single draw for each rather than switching mode twice a ball. Wound like DrawCircle()
+        rlBegin(RL_TRIANGLES);
+        for (const TessellatedCircle& circle : renderer.circles)
+        {
+            const std::vector<Vector2>& unit = *circle.unit;
+            const int segments = unit.size() - 1;
+            const Vector2 c = circle.centre;
+            const float r = circle.radius;
+
+            rlCheckRenderBatchLimit(segments * 3);
+            rlColor4ub(circle.color.r, circle.color.g, circle.color.b, circle.color.a);
+            for (int s = 0; s < segments; ++s)
+            {
+                rlVertex2f(c.x, c.y);
+                rlVertex2f(c.x + unit[s + 1].x * r, c.y + unit[s + 1].y * r);
+                rlVertex2f(c.x + unit[s].x * r, c.y + unit[s].y * r);
+            }
+        }
+        rlEnd();
+
+        rlBegin(RL_LINES);
+        rlColor4ub(outline.r, outline.g, outline.b, outline.a);
+        for (const TessellatedCircle& circle : renderer.circles)
+        {
+            const std::vector<Vector2>& unit = *circle.unit;
+            const int segments = unit.size() - 1;
+            const Vector2 c = circle.centre;
+            const float r = circle.radius;
+
+            rlCheckRenderBatchLimit(segments * 2);
+            for (int s = 0; s < segments; ++s)
+            {
+                rlVertex2f(c.x + unit[s].x * r, c.y + unit[s].y * r);
+                rlVertex2f(c.x + unit[s + 1].x * r, c.y + unit[s + 1].y * r);
+            }
+
+            ++renderer.stats.drawn;
+            renderer.stats.vertices += segments * 5;
+        }
+        rlEnd();
+
+        renderer.stats.discs = renderer.discs.size();
+        if (renderer.discs.empty())
+        {
+            return;
+        }
+
+        rlDrawRenderBatchActive();
+
+        rlEnableShader(renderer.disc_shader.id);
+        rlSetUniformMatrix(renderer.mvp_loc, CurrentMVP());
+
+        const float pixel_size = 1.0f / zoom;
+        const float outline_color[4] = { outline.r / 255.0f, outline.g / 255.0f, outline.b / 255.0f, outline.a / 255.0f };
+        rlSetUniform(renderer.pixel_size_loc, &pixel_size, RL_SHADER_UNIFORM_FLOAT, 1);
+        rlSetUniform(renderer.outline_loc, outline_color, RL_SHADER_UNIFORM_VEC4, 1);
+
+        rlDisableBackfaceCulling();
+        DrawInstancedMesh(renderer.quad, renderer.discs.data(), renderer.discs.size());
+        rlEnableBackfaceCulling();
+
+        rlDisableShader();
+    }
+
+    // the screen canvas draws its balls as a density map or through the batch when it has one
+    template <typename Ball>
+    void CanvasBalls(ScreenCanvas& canvas, const std::vector<Ball>& balls, const Color& outline)
+    {
+        if (canvas.density != NULL)
+        {
+            BinDensity(*canvas.density, balls);
+            UploadDensityMap(*canvas.density);
+            DrawDensityMap(*canvas.density);
+            return;
+        }
+
+        if (canvas.circles == NULL)
+        {
+            for (int i = 0; i < balls.size(); ++i)
+            {
+                DrawCircle(balls[i].position.x, balls[i].position.y, balls[i].radius, balls[i].color);
+                DrawCircleLines(balls[i].position.x, balls[i].position.y, balls[i].radius, outline);
+            }
+            return;
+        }
+
+        DrawCircles(*canvas.circles, canvas.camera, balls, outline);
+    }
+};
+
+#endif
@@ -0,0 +1,509 @@
+#ifndef RENDER3D_H
+#define RENDER3D_H
+
+#include "defs.h"
+#include "culling.h"
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+
+// instanced drawing for the 3D mode, Draw3DSphere() builds and pushes a whole sphere through
+// rlgl's immediate mode every call which falls over long before we run out of physics, so
+// instead each mesh is uploaded once into its own VAO and every copy of it goes out in a
+// single draw call, with the per-copy data (position, size, colour) streamed into a second
+// vertex buffer that advances once per instance instead of once per vertex
+
+extern "C" void* glfwGetProcAddress(const char* name);
+
+namespace Graphics
+{
+    // rlgl only draws instanced triangles, line meshes go straight to GL
+    typedef void (*GLDrawArraysInstancedFn)(unsigned int mode, int first, int count, int instances);
+
+    const unsigned int GL_LINES_ = 0x0001;
+
+    inline GLDrawArraysInstancedFn gl_draw_arrays_instanced = NULL;
+
+    // one per-instance vertex attribute, the shaders pick them up with layout(location = N)
+    typedef struct InstanceAttribute
+    {
+        int location;
+        int components;
+        int type;               // RL_FLOAT or RL_UNSIGNED_BYTE (bytes get normalized to 0..1)
+        int offset;             // bytes into the instance struct
+
+    } InstanceAttribute;
+
+    typedef struct InstancedMesh
+    {
+        unsigned int vao;
+        unsigned int vbo_vertices;
+        unsigned int vbo_normals;
+        unsigned int vbo_instances;
+        int vertex_count;
+        int instance_stride;
+        int instance_capacity;
+        bool lines;                     // vertices are pairs of line ends rather than triangles
+        std::vector<InstanceAttribute> attributes;
+
+    } InstancedMesh;
+
+    // (re)creates the instance buffer and points the per-instance attributes at it, the vao must be bound
+    inline void AllocateInstanceBuffer(InstancedMesh& im, int capacity)
+    {
+        if (im.vbo_instances != 0)
+        {
+            rlUnloadVertexBuffer(im.vbo_instances);
+        }
+
+        im.instance_capacity = capacity;
+        im.vbo_instances = rlLoadVertexBuffer(NULL, capacity * im.instance_stride, true);
+
+        for (int a = 0; a < im.attributes.size(); ++a)
+        {
+            const InstanceAttribute& attr = im.attributes[a];
+            rlSetVertexAttribute(attr.location, attr.components, attr.type, attr.type == RL_UNSIGNED_BYTE, im.instance_stride, attr.offset);
+            rlSetVertexAttributeDivisor(attr.location, 1);
+            rlEnableVertexAttribute(attr.location);
+        }
+    }
+
+    // uploads the (non indexed) triangles of mesh, or its lines if lines is set, positions go to location 0
+    // and normals to location 2 like raylib's default shader attributes, the mesh itself can be unloaded afterwards
+    inline void LoadInstancedMesh(InstancedMesh& im, const Mesh& mesh, const std::vector<InstanceAttribute>& attributes, int instance_stride, bool lines = false)
+    {
+        im.vertex_count = mesh.vertexCount;
+        im.instance_stride = instance_stride;
+        im.lines = lines;
+        im.attributes = attributes;
+
+        if (lines && gl_draw_arrays_instanced == NULL)
+        {
+            gl_draw_arrays_instanced = (GLDrawArraysInstancedFn)glfwGetProcAddress("glDrawArraysInstanced");
+        }
+        im.vbo_instances = 0;
+        im.vbo_normals = 0;
+
+        im.vao = rlLoadVertexArray();
+        rlEnableVertexArray(im.vao);
+
+        im.vbo_vertices = rlLoadVertexBuffer(mesh.vertices, mesh.vertexCount * 3 * sizeof(float), false);
+        rlSetVertexAttribute(0, 3, RL_FLOAT, false, 0, 0);
+        rlEnableVertexAttribute(0);
+
+        if (mesh.normals != NULL)
+        {
+            im.vbo_normals = rlLoadVertexBuffer(mesh.normals, mesh.vertexCount * 3 * sizeof(float), false);
+            rlSetVertexAttribute(2, 3, RL_FLOAT, false, 0, 0);
+            rlEnableVertexAttribute(2);
+        }
+
+        AllocateInstanceBuffer(im, 1024);
+
+        rlDisableVertexArray();
+    }
+
+    inline void UnloadInstancedMesh(InstancedMesh& im)
+    {
+        rlUnloadVertexBuffer(im.vbo_vertices);
+        rlUnloadVertexBuffer(im.vbo_normals);
+        rlUnloadVertexBuffer(im.vbo_instances);
+        rlUnloadVertexArray(im.vao);
+    }
+
+    // uploads count instances and draws them all, the shader must already be enabled
+    inline void DrawInstancedMesh(InstancedMesh& im, const void* instances, int count)
+    {
+        if (count <= 0)
+        {
+            return;
+        }
+
+        rlEnableVertexArray(im.vao);
+
+        if (count > im.instance_capacity)
+        {
+            int capacity = im.instance_capacity;
+            while (capacity < count)
+            {
+                capacity *= 2;
+            }
+            AllocateInstanceBuffer(im, capacity);
+        }
+
+        rlUpdateVertexBuffer(im.vbo_instances, instances, count * im.instance_stride, 0);
+        if (im.lines)
+        {
+            gl_draw_arrays_instanced(GL_LINES_, 0, im.vertex_count, count);
+        }
+        else
+        {
+            rlDrawVertexArrayInstanced(0, im.vertex_count, count);
+        }
+
+        rlDisableVertexArray();
+    }
+
+    // the model view projection matrix the current BeginMode3D() set up
+    inline Matrix CurrentMVP() { return MatrixMultiply(rlGetMatrixModelview(), rlGetMatrixProjection()); }
+
+    inline const char* sphere_instancing_vs = R"(
+        #version 330
+        layout(location = 0) in vec3 vertexPosition;
+        layout(location = 2) in vec3 vertexNormal;
+        layout(location = 9) in vec4 instanceSphere;       // xyz centre, w radius
+        layout(location = 10) in vec4 instanceColor;
+        uniform mat4 mvp;
+        out vec3 fragNormal;
+        out vec4 fragColor;
+
+        void main()
+        {
+            fragNormal = vertexNormal;
+            fragColor = instanceColor;
+            gl_Position = mvp * vec4(instanceSphere.xyz + vertexPosition * instanceSphere.w, 1.0);
+        }
+    )";
+
+    inline const char* sphere_instancing_fs = R"(
+        #version 330
+        in vec3 fragNormal;
+        in vec4 fragColor;
+        out vec4 finalColor;
+
+        void main()
+        {
+            float light = 0.35 + 0.65 * max(dot(normalize(fragNormal), normalize(vec3(0.4, 1.0, 0.6))), 0.0);
+            finalColor = vec4(fragColor.rgb * light, fragColor.a);
+        }
+    )";
+
+    typedef struct SphereInstance
+    {
+        Vector3 center;
+        float radius;
+        Color color;
+
+    } SphereInstance;
+
+    // unit spheres from fine to coarse, picked by how many pixels tall a sphere ends up on screen
+    const int sphere_lods = 4;
+    const int sphere_lod_rings[sphere_lods] = { 16, 10, 6, 4 };
+    const int sphere_lod_slices[sphere_lods] = { 24, 14, 8, 6 };
+    const float sphere_lod_min_pixels[sphere_lods] = { 48.0f, 16.0f, 6.0f, 0.0f };  // projected radius to use each level
+
+    typedef struct SphereRenderer
+    {
+        Shader shader;
+        int mvp_loc;
+        InstancedMesh lods[sphere_lods];
+        std::vector<SphereInstance> instances[sphere_lods];
+        CullBatch cull;
+        CullStats stats;            // last frame, for the overlay
+        int draw_calls;
+
+    } SphereRenderer;
+
+    inline void LoadSphereRenderer(SphereRenderer& renderer)
+    {
+        renderer.shader = LoadShaderFromMemory(sphere_instancing_vs, sphere_instancing_fs);
+        renderer.mvp_loc = GetShaderLocation(renderer.shader, "mvp");
+        renderer.draw_calls = 0;
+        renderer.stats = CullStats{ 0, 0, 0 };
+
+        std::vector<InstanceAttribute> attributes = {
+            { 9, 4, RL_FLOAT, (int)offsetof(SphereInstance, center) },      // centre and radius sit next to each other
+            { 10, 4, RL_UNSIGNED_BYTE, (int)offsetof(SphereInstance, color) }
+        };
+
+        for (int l = 0; l < sphere_lods; ++l)
+        {
+            Mesh mesh = GenMeshSphere(1.0f, sphere_lod_rings[l], sphere_lod_slices[l]);
+            LoadInstancedMesh(renderer.lods[l], mesh, attributes, sizeof(SphereInstance));
+            UnloadMesh(mesh);
+        }
+    }
+
+    inline void UnloadSphereRenderer(SphereRenderer& renderer)
+    {
+        for (int l = 0; l < sphere_lods; ++l)
+        {
+            UnloadInstancedMesh(renderer.lods[l]);
+        }
+        UnloadShader(renderer.shader);
+    }
+
+    // how many pixels the radius of a sphere covers at a given distance from the camera
+    inline float ProjectedRadius(const Camera3D& cam, float radius, float distance)
+    {
+        const float pixels_per_unit = GetScreenHeight() / (2.0f * tanf(cam.fovy * 0.5f * DEG2RAD));
+        return radius * pixels_per_unit / fmaxf(distance, 1e-3f);
+    }
+
+    inline int SphereLOD(float projected_radius)
+    {
+        int l = 0;
+        while (l < sphere_lods - 1 && projected_radius < sphere_lod_min_pixels[l])
+        {
+            ++l;
+        }
+        return l;
+    }
+
+    // culls the spheres against the camera, sorts what's left into LOD buckets and draws each bucket
+    // with one instanced call, call inside BeginMode3D()
+    inline void DrawSpheres(SphereRenderer& renderer, const Camera3D& cam, const std::vector<Raylib::Sphere>& spheres)
+    {
+        for (int l = 0; l < sphere_lods; ++l)
+        {
+            renderer.instances[l].clear();
+        }
+
+        ClearCullBatch(renderer.cull);
+        for (int i = 0; i < spheres.size(); ++i)
+        {
+            AddToCullBatch(renderer.cull, spheres[i].centerPos, spheres[i].radius);
+        }
+
+        renderer.stats = CullStats{ 0, 0, 0 };
+        CullSpheres(ExtractFrustum(cam), renderer.cull, renderer.stats);
+
+        for (int v = 0; v < renderer.cull.visible.size(); ++v)
+        {
+            const Raylib::Sphere& s = spheres[renderer.cull.visible[v]];
+            float distance = Vector3Distance(s.centerPos, cam.position);
+            int l = SphereLOD(ProjectedRadius(cam, s.radius, distance));
+
+            renderer.instances[l].push_back(SphereInstance{ s.centerPos, s.radius, s.color });
+        }
+
+        // anything already queued through rlgl (the box lines) has to go out first
+        rlDrawRenderBatchActive();
+
+        rlEnableShader(renderer.shader.id);
+        rlSetUniformMatrix(renderer.mvp_loc, CurrentMVP());
+
+        renderer.draw_calls = 0;
+        for (int l = 0; l < sphere_lods; ++l)
+        {
+            if (!renderer.instances[l].empty())
+            {
+                DrawInstancedMesh(renderer.lods[l], renderer.instances[l].data(), renderer.instances[l].size());
+                ++renderer.draw_calls;
+            }
+        }
+
+        rlDisableShader();
+    }
+
+    inline const char* cube_instancing_vs = R"(
+        #version 330
+        layout(location = 0) in vec3 vertexPosition;
+        layout(location = 2) in vec3 vertexNormal;
+        layout(location = 9) in mat4 instanceTransform;    // takes locations 9 to 12
+        layout(location = 13) in vec4 instanceColor;
+        uniform mat4 mvp;
+        out vec3 fragNormal;
+        out vec4 fragColor;
+
+        void main()
+        {
+            fragNormal = mat3(instanceTransform) * vertexNormal;
+            fragColor = instanceColor;
+            gl_Position = mvp * instanceTransform * vec4(vertexPosition, 1.0);
+        }
+    )";
+
+    inline const char* cube_instancing_fs = R"(
+        #version 330
+        in vec3 fragNormal;
+        in vec4 fragColor;
+        uniform float lit;
+        out vec4 finalColor;
+
+        void main()
+        {
+            float light = 0.35 + 0.65 * max(dot(normalize(fragNormal), normalize(vec3(0.4, 1.0, 0.6))), 0.0);
+            finalColor = vec4(fragColor.rgb * mix(1.0, light, lit), fragColor.a);
+        }
+    )";
+
+    typedef struct CubeInstance
+    {
+        float16 transform;          // column major, straight from MatrixToFloatV()
+        Color color;
+
+    } CubeInstance;
+
+    // every cube queued in a frame goes out as one instanced draw for the solid ones and one for the wires,
+    // instead of each Draw3DCube() pushing and popping the rlgl matrix stack and transforming its
+    // vertices on the CPU
+    typedef struct CubeRenderer
+    {
+        Shader shader;
+        int mvp_loc;
+        int lit_loc;
+        InstancedMesh solid;        // 12 triangles
+        InstancedMesh wires;        // 12 edges
+        std::vector<CubeInstance> solid_instances;
+        std::vector<CubeInstance> wire_instances;
+
+        // what BeginCubes() saw, cubes and cylinders off screen never get queued
+        Frustum frustum;
+        bool cull = false;
+        CullStats stats = { 0, 0, 0 };       // this frame so far, cubes and cylinders together
+
+    } CubeRenderer;
+
+    inline void LoadCubeRenderer(CubeRenderer& renderer)
+    {
+        renderer.shader = LoadShaderFromMemory(cube_instancing_vs, cube_instancing_fs);
+        renderer.mvp_loc = GetShaderLocation(renderer.shader, "mvp");
+        renderer.lit_loc = GetShaderLocation(renderer.shader, "lit");
+
+        std::vector<InstanceAttribute> attributes = {
+            { 9, 4, RL_FLOAT, (int)offsetof(CubeInstance, transform) },
+            { 10, 4, RL_FLOAT, (int)offsetof(CubeInstance, transform) + 16 },
+            { 11, 4, RL_FLOAT, (int)offsetof(CubeInstance, transform) + 32 },
+            { 12, 4, RL_FLOAT, (int)offsetof(CubeInstance, transform) + 48 },
+            { 13, 4, RL_UNSIGNED_BYTE, (int)offsetof(CubeInstance, color) }
+        };
+
+        // unit cube corners, bit 0 is +x, bit 1 is +y, bit 2 is +z
+        Vector3 corners[8];
+        for (int c = 0; c < 8; ++c)
+        {
+            corners[c] = Vector3{ (c & 1) ? 0.5f : -0.5f, (c & 2) ? 0.5f : -0.5f, (c & 4) ? 0.5f : -0.5f };
+        }
+
+        // each face as 4 corners counter clockwise seen from outside, and its normal
+        const int faces[6][4] = { { 1, 3, 7, 5 }, { 0, 4, 6, 2 }, { 2, 6, 7, 3 }, { 0, 1, 5, 4 }, { 4, 5, 7, 6 }, { 0, 2, 3, 1 } };
+        const Vector3 normals[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+        const int corner_order[6] = { 0, 1, 2, 0, 2, 3 };
+
+        std::vector<float> vertices, vertex_normals;
+        for (int f = 0; f < 6; ++f)
+        {
+            for (int k = 0; k < 6; ++k)
+            {
+                const Vector3& v = corners[faces[f][corner_order[k]]];
+                vertices.insert(vertices.end(), { v.x, v.y, v.z });
+                vertex_normals.insert(vertex_normals.end(), { normals[f].x, normals[f].y, normals[f].z });
+            }
+        }
+
+        Mesh mesh = {};
+        mesh.vertexCount = vertices.size() / 3;
+        mesh.vertices = vertices.data();
+        mesh.normals = vertex_normals.data();
+        LoadInstancedMesh(renderer.solid, mesh, attributes, sizeof(CubeInstance));
+
+        // the 12 edges as line pairs
+        vertices.clear();
+        for (int c = 0; c < 8; ++c)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                if ((c & (1 << axis)) == 0)
+                {
+                    const Vector3& a = corners[c];
+                    const Vector3& b = corners[c | (1 << axis)];
+                    vertices.insert(vertices.end(), { a.x, a.y, a.z, b.x, b.y, b.z });
+                }
+            }
+        }
+
+        mesh.vertexCount = vertices.size() / 3;
+        mesh.vertices = vertices.data();
+        mesh.normals = NULL;
+        LoadInstancedMesh(renderer.wires, mesh, attributes, sizeof(CubeInstance), true);
+    }
+
+    inline void UnloadCubeRenderer(CubeRenderer& renderer)
+    {
+        UnloadInstancedMesh(renderer.solid);
+        UnloadInstancedMesh(renderer.wires);
+        UnloadShader(renderer.shader);
+    }
+
+    // once a frame before anything is queued, inside BeginMode3D(camera)
+    inline void BeginCubes(CubeRenderer& renderer, const Camera3D& cam)
+    {
+        renderer.frustum = ExtractFrustum(cam);
+        renderer.cull = true;
+        renderer.stats = CullStats{ 0, 0, 0 };
+    }
+
+    // one bounding sphere against the frustum, counted in the stats
+    inline bool CullOne(CubeRenderer& renderer, const Vector3& center, float radius)
+    {
+        const bool visible = !renderer.cull || SphereInFrustum(renderer.frustum, center, radius);
+        ++renderer.stats.tested;
+        renderer.stats.submitted += visible ? 1 : 0;
+        renderer.stats.culled += visible ? 0 : 1;
+        return visible;
+    }
+
+    // half the diagonal reaches every corner however the cube is turned around y
+    inline float CubeBoundingRadius(const Raylib::Cube& cube)
+    {
+        return 0.5f * sqrtf(cube.width * cube.width + cube.height * cube.height + cube.length * cube.length);
+    }
+
+    // same look as Cube::Draw3DCube() / Draw3DCubeLines(), but only queued until DrawCubes()
+    inline void QueueCube(CubeRenderer& renderer, Raylib::Cube& cube)
+    {
+        if (CullOne(renderer, cube.position, CubeBoundingRadius(cube)))
+        {
+            renderer.solid_instances.push_back(CubeInstance{ MatrixToFloatV(cube.GetTransform()), cube.color });
+        }
+    }
+
+    inline void QueueCubeLines(CubeRenderer& renderer, Raylib::Cube& cube, const Color& border)
+    {
+        if (CullOne(renderer, cube.position, CubeBoundingRadius(cube)))
+        {
+            renderer.wire_instances.push_back(CubeInstance{ MatrixToFloatV(cube.GetTransform()), border });
+        }
+    }
+
+    // Cylinder::Queue3DCylinder() when it's on screen, the cylinders go through the mesh cache but
+    // get culled and counted along with the cubes. The sphere is centred half way up and reaches
+    // the rim of the wider end
+    inline void QueueCylinder(CubeRenderer& renderer, Raylib::Cylinder& cylinder)
+    {
+        const float half = 0.5f * cylinder.height;
+        const float rim = fmaxf(cylinder.radiusTop, cylinder.radiusBottom);
+        const Vector3 center = { cylinder.position.x, cylinder.position.y + half, cylinder.position.z };
+
+        if (CullOne(renderer, center, sqrtf(half * half + rim * rim)))
+        {
+            cylinder.Queue3DCylinder();
+        }
+    }
+
+    // draws and clears everything queued, call inside BeginMode3D()
+    inline void DrawCubes(CubeRenderer& renderer)
+    {
+        rlDrawRenderBatchActive();
+
+        rlEnableShader(renderer.shader.id);
+        rlSetUniformMatrix(renderer.mvp_loc, CurrentMVP());
+
+        float lit = 1.0f;
+        rlSetUniform(renderer.lit_loc, &lit, RL_SHADER_UNIFORM_FLOAT, 1);
+        DrawInstancedMesh(renderer.solid, renderer.solid_instances.data(), renderer.solid_instances.size());
+
+        lit = 0.0f;
+        rlSetUniform(renderer.lit_loc, &lit, RL_SHADER_UNIFORM_FLOAT, 1);
+        DrawInstancedMesh(renderer.wires, renderer.wire_instances.data(), renderer.wire_instances.size());
+
+        rlDisableShader();
+
+        renderer.solid_instances.clear();
+        renderer.wire_instances.clear();
+    }
+};
+
+#endif
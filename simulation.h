@@ -0,0 +1,316 @@
+#ifndef SIMULATION_H
+#define SIMULATION_H
+
+#include "defs.h"
+#include "dimension.h"
+#include "forces.h"
+#include "nbody.h"
+#include "integrators.h"
+#include "collisions.h"
+#include "handles.h"
+#include "morton.h"
+#include "parallel.h"
+
+#include <vector>
+#include <utility>
+#include <chrono>
+
+// the simulation core, templated on dimension (2 for circles, 3 for spheres), on the feature
+// mask and on the integrator, so every configuration compiles to its own kernel with the
+// stages it doesn't use stripped out, SelectStepFunction() picks one once at startup
+
+namespace Physics
+{
+    // where a step spends its time, forces are timed every time the integrator asks for them
+    // so integrate is just the integrator's own loops
+    enum StepPhase
+    {
+        PHASE_REORDER,
+        PHASE_FORCES,
+        PHASE_INTEGRATE,
+        PHASE_WALLS,
+        PHASE_BROADPHASE,
+        PHASE_NARROWPHASE,
+        PHASE_SOLVE,
+        PHASE_COUNT
+    };
+
+    inline const char* phase_names[PHASE_COUNT] = { "reorder", "forces", "integrate", "walls", "broadphase", "narrowphase", "solve" };
+
+    typedef struct StepTimings
+    {
+        float ms[PHASE_COUNT] = {};
+
+    } StepTimings;
+
+    typedef std::chrono::steady_clock StepClock;
+
+    // milliseconds since start, and start moves up to now for the next phase
+    inline float Lap(StepClock::time_point& start)
+    {
+        const StepClock::time_point now = StepClock::now();
+        const float ms = std::chrono::duration<float, std::milli>(now - start).count();
+        start = now;
+        return ms;
+    }
+
+    template <int D>
+    struct Simulation
+    {
+        typedef typename Dimension<D>::Body Body;
+        typedef typename Dimension<D>::Vec Vec;
+
+        std::vector<Body> balls;
+        Vec bounds_min, bounds_max;         // the walls
+        ForceSet forces;
+        NBodySettings nbody;
+        float restitution = 1.0f;           // ball vs ball, walls are always perfectly bouncy
+        BroadphaseType broadphase = BROADPHASE_GRID;
+        StepTimings timings;                // the last step
+        HandleTable handles;                // stable names for the balls, see pool.h
+        BallOrder<D> order;                 // when the balls last got sorted into Z-order
+
+        // scratch kept between steps
+        IntegratorState<Body> integrator;
+        QuadTree tree;
+        UniformGrid<D> grid;
+        SortedGrid<D> sorted_grid;
+        std::vector<CollisionPair> pairs;
+        std::vector<Contact<Vec>> contacts;
+        Parallel::TaskGraph graph;                  // the step's jobs, see StepSimulation()
+        Parallel::TaskGraph force_graph;            // the force fields beside the n-body gravity
+        std::vector<Vec> nbody_accel;               // what the n-body gravity adds, while the fields write accel
+        ChunkLists<CollisionPair> pair_lists;       // per chunk of balls while the pairs are found in parallel
+        ChunkLists<Contact<Vec>> contact_lists;
+    };
+
+    template <int D>
+    using StepFunction = void (*)(Simulation<D>&, float);
+
+    // pushes balls back inside the box and points their velocity away from the wall they hit,
+    // just flipping it lets gravity drag a ball back through the floor every frame
+    template <int D>
+    void ResolveWalls(Simulation<D>& sim)
+    {
+        for (int i = 0; i < sim.balls.size(); ++i)
+        {
+            auto& pos = Position(sim.balls[i]);
+            auto& vel = sim.balls[i].velocity;
+            const float r = sim.balls[i].radius;
+
+            for (int axis = 0; axis < D; ++axis)
+            {
+                const float lo = Component(sim.bounds_min, axis) + r;
+                const float hi = Component(sim.bounds_max, axis) - r;
+
+                if (Component(pos, axis) >= hi)
+                {
+                    Component(pos, axis) = hi;
+                    Component(vel, axis) = -fabsf(Component(vel, axis));
+                }
+                else if (Component(pos, axis) <= lo)
+                {
+                    Component(pos, axis) = lo;
+                    Component(vel, axis) = fabsf(Component(vel, axis));
+                }
+            }
+        }
+    }
+
+    // puts the balls in Z-order and makes everything that goes by ball index follow them
+    template <int D>
+    void ReorderBalls(Simulation<D>& sim)
+    {
+        SyncHandles(sim.handles, sim.balls.size());
+        SortBalls(sim.order, sim.balls, sim.bounds_min, sim.bounds_max);
+        ReorderHandles(sim.handles, sim.order.order, sim.order.scratch.values);
+
+        // Verlet works its acceleration out again (same positions, same answer) and the grid gets
+        // built again from the new indices on the next update
+        sim.integrator.accel_valid = false;
+        sim.grid.cell_head.clear();
+    }
+
+    template <int D, unsigned Features, typename Integrator>
+    void StepSimulation(Simulation<D>& sim, float dt)
+    {
+        typedef typename Dimension<D>::Body Body;
+        typedef typename Dimension<D>::Vec Vec;
+
+        float* ms = sim.timings.ms;
+        float forces_ms = 0.0f;
+
+        // the integrator asks for forces as often as it needs (RK4 wants 4 per step). The force
+        // fields and the n-body gravity only read the balls, so with n-body on they're two jobs that
+        // run side by side, the gravity into a buffer of its own that's added on once both are done
+        auto accel_fn = [&](const std::vector<Body>& balls, std::vector<Vec>& accel)
+        {
+            StepClock::time_point start = StepClock::now();
+
+            auto fields = [&]
+            {
+                Memory::MemoryScope memory(Memory::MEM_FORCES);
+                ComputeAccelerations<Features>(sim.forces, balls, accel);
+            };
+
+            auto nbody = [&]
+            {
+                Memory::MemoryScope memory(Memory::MEM_NBODY);
+                sim.nbody_accel.assign(balls.size(), Vec{});
+                AddNBodyGravity(sim.nbody, sim.tree, balls, sim.nbody_accel);
+            };
+
+            if (!sim.nbody.enabled)
+            {
+                fields();
+            }
+            else
+            {
+                Parallel::ClearGraph(sim.force_graph);
+                Parallel::AddJob(sim.force_graph, fields);
+                Parallel::AddJob(sim.force_graph, nbody);
+                Parallel::RunGraph(sim.force_graph);
+
+                for (int i = 0; i < balls.size(); ++i)
+                {
+                    accel[i] = accel[i] + sim.nbody_accel[i];
+                }
+            }
+            forces_ms += Lap(start);
+        };
+
+        // the step as a graph of jobs on the scheduler. Reorder, integrate, walls, broadphase,
+        // narrowphase and solve each need the balls the one before left, so they're a chain and
+        // the loops inside them are what spreads over the cores (the forces inside integrate are
+        // the one place with two jobs side by side, see accel_fn). The snapshot for the render
+        // thread is copied after the step since it wants the solved balls. Every job times itself
+        // and tags what it allocates with its subsystem
+        auto reorder = [&]
+        {
+            Memory::MemoryScope memory(Memory::MEM_REORDER);
+            StepClock::time_point start = StepClock::now();
+            ++sim.order.steps;
+            if (ReorderDue(sim.order, sim.balls.size()))
+            {
+                ReorderBalls(sim);
+            }
+            ms[PHASE_REORDER] = Lap(start);
+        };
+
+        auto integrate = [&]
+        {
+            Memory::MemoryScope memory(Memory::MEM_INTEGRATE);
+            StepClock::time_point start = StepClock::now();
+            Integrator::Step(dt, sim.balls, accel_fn, sim.integrator);
+            ms[PHASE_INTEGRATE] = Lap(start) - forces_ms;
+            ms[PHASE_FORCES] = forces_ms;
+        };
+
+        auto walls = [&]
+        {
+            Memory::MemoryScope memory(Memory::MEM_COLLISIONS);
+            StepClock::time_point start = StepClock::now();
+            ResolveWalls(sim);
+            ms[PHASE_WALLS] = Lap(start);
+        };
+
+        auto broadphase = [&]
+        {
+            Memory::MemoryScope memory(Memory::MEM_COLLISIONS);
+            StepClock::time_point start = StepClock::now();
+            if (sim.broadphase == BROADPHASE_GRID)
+            {
+                const int rebuilds = sim.grid.rebuilds;
+                UpdateGrid(sim.grid, sim.balls, sim.bounds_min, sim.bounds_max);
+                sim.order.moved += sim.grid.rebuilds == rebuilds ? sim.grid.moved : 0;
+                FindPairsGrid(sim.grid, sim.balls, sim.pairs, sim.pair_lists);
+            }
+            else if (sim.broadphase == BROADPHASE_SORTED)
+            {
+                BuildSortedGrid(sim.sorted_grid, sim.balls, sim.bounds_min, sim.bounds_max);
+                FindPairsSorted(sim.sorted_grid, sim.balls, sim.pairs, sim.pair_lists);
+            }
+            else
+            {
+                FindPairsBrute(sim.balls, sim.pairs, sim.pair_lists);
+            }
+            ms[PHASE_BROADPHASE] = Lap(start);
+        };
+
+        auto narrowphase = [&]
+        {
+            Memory::MemoryScope memory(Memory::MEM_COLLISIONS);
+            StepClock::time_point start = StepClock::now();
+            Narrowphase(sim.balls, sim.pairs, sim.contacts, sim.contact_lists);
+            ms[PHASE_NARROWPHASE] = Lap(start);
+        };
+
+        auto solve = [&]
+        {
+            Memory::MemoryScope memory(Memory::MEM_COLLISIONS);
+            StepClock::time_point start = StepClock::now();
+            SolveContacts(sim.balls, sim.contacts, sim.restitution);
+            ms[PHASE_SOLVE] = Lap(start);
+        };
+
+        Parallel::TaskGraph& graph = sim.graph;
+        Parallel::ClearGraph(graph);
+
+        int last = Parallel::AddJob(graph, reorder);
+        int next = Parallel::AddJob(graph, integrate);
+        Parallel::Precede(graph, last, next);
+        last = next;
+
+        next = Parallel::AddJob(graph, walls);
+        Parallel::Precede(graph, last, next);
+        last = next;
+
+        ms[PHASE_BROADPHASE] = ms[PHASE_NARROWPHASE] = ms[PHASE_SOLVE] = 0.0f;
+        if constexpr ((Features & FEATURE_COLLISIONS) != 0)
+        {
+            next = Parallel::AddJob(graph, broadphase);
+            Parallel::Precede(graph, last, next);
+            last = next;
+
+            next = Parallel::AddJob(graph, narrowphase);
+            Parallel::Precede(graph, last, next);
+            last = next;
+
+            next = Parallel::AddJob(graph, solve);
+            Parallel::Precede(graph, last, next);
+        }
+
+        Parallel::RunGraph(graph);
+    }
+
+    template <int D, typename Integrator, unsigned... Masks>
+    StepFunction<D> SelectStepFunction(unsigned features, std::integer_sequence<unsigned, Masks...>)
+    {
+        static const StepFunction<D> kernels[] = { &StepSimulation<D, Masks, Integrator>... };
+        return kernels[features & FEATURE_ALL];
+    }
+
+    // every feature mask gets compiled, this just indexes the table
+    template <int D, typename Integrator>
+    StepFunction<D> SelectStepFunction(unsigned features)
+    {
+        return SelectStepFunction<D, Integrator>(features, std::make_integer_sequence<unsigned, FEATURE_ALL + 1>());
+    }
+
+    // same again with the integrator picked by its name ("euler", "semi-implicit", "verlet", "rk4"),
+    // for when it comes from a config file. NULL if there's no integrator called that
+    template <int D>
+    StepFunction<D> SelectStepFunction(const std::string& integrator, unsigned features)
+    {
+        if (integrator == ExplicitEuler::name)          return SelectStepFunction<D, ExplicitEuler>(features);
+        if (integrator == SemiImplicitEuler::name)      return SelectStepFunction<D, SemiImplicitEuler>(features);
+        if (integrator == VelocityVerlet::name)         return SelectStepFunction<D, VelocityVerlet>(features);
+        if (integrator == RK4::name)                    return SelectStepFunction<D, RK4>(features);
+        return NULL;
+    }
+
+    inline const char* integrator_names[] = { ExplicitEuler::name, SemiImplicitEuler::name, VelocityVerlet::name, RK4::name };
+    inline const int integrator_count = sizeof(integrator_names) / sizeof(integrator_names[0]);
+};
+
+#endif
@@ -0,0 +1,431 @@
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+#include "canvas.h"
+#include "parallel.h"
+
+#include <raylib.h>
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+// a CPU rasterizer for the handful of 2D primitives the scene uses, so frames can be rendered
+// without a window or a GPU (CI, golden image tests, capturing). Drawing only records commands,
+// RasterizeSoftCanvas() then bins them into tiles and every thread fills its own tiles, so no two
+// threads ever touch the same pixel and no locking is needed
+
+namespace Graphics
+{
+    enum SoftCommandType
+    {
+        SOFT_CLEAR,
+        SOFT_CIRCLE,
+        SOFT_CIRCLE_LINES,
+        SOFT_LINE,
+        SOFT_RECTANGLE,
+        SOFT_TEXT
+    };
+
+    typedef struct SoftCommand
+    {
+        SoftCommandType type;
+        float x0, y0, x1, y1;           // centre / start / top left, and end / bottom right
+        float radius;
+        int text_offset, text_length;   // into SoftCanvas::text
+        int font_size;
+        Color color;
+        int min_x, min_y, max_x, max_y; // pixels it can touch, max is exclusive
+
+    } SoftCommand;
+
+    typedef struct SoftCanvas
+    {
+        int width = 0;
+        int height = 0;
+        int tile_size = 64;
+        std::vector<Color> pixels;              // RGBA8, row major, same layout as a raylib Image
+        std::vector<SoftCommand> commands;
+        std::string text;                       // every string drawn this frame, back to back
+        std::vector<std::vector<int>> bins;     // commands touching each tile, in draw order
+
+    } SoftCanvas;
+
+    // classic 5x7 font for ' ' to '~', 5 columns per glyph, bit 0 is the top row
+    const unsigned char soft_font[95][5] = {
+        { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5F, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 }, { 0x14, 0x7F, 0x14, 0x7F, 0x14 },
+        { 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 }, { 0x36, 0x49, 0x55, 0x22, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 },
+        { 0x00, 0x1C, 0x22, 0x41, 0x00 }, { 0x00, 0x41, 0x22, 0x1C, 0x00 }, { 0x08, 0x2A, 0x1C, 0x2A, 0x08 }, { 0x08, 0x08, 0x3E, 0x08, 0x08 },
+        { 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x60, 0x60, 0x00, 0x00 }, { 0x20, 0x10, 0x08, 0x04, 0x02 },
+        { 0x3E, 0x51, 0x49, 0x45, 0x3E }, { 0x00, 0x42, 0x7F, 0x40, 0x00 }, { 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4B, 0x31 },
+        { 0x18, 0x14, 0x12, 0x7F, 0x10 }, { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3C, 0x4A, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 },
+        { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1E }, { 0x00, 0x36, 0x36, 0x00, 0x00 }, { 0x00, 0x56, 0x36, 0x00, 0x00 },
+        { 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 }, { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 },
+        { 0x32, 0x49, 0x79, 0x41, 0x3E }, { 0x7E, 0x11, 0x11, 0x11, 0x7E }, { 0x7F, 0x49, 0x49, 0x49, 0x36 }, { 0x3E, 0x41, 0x41, 0x41, 0x22 },
+        { 0x7F, 0x41, 0x41, 0x22, 0x1C }, { 0x7F, 0x49, 0x49, 0x49, 0x41 }, { 0x7F, 0x09, 0x09, 0x09, 0x01 }, { 0x3E, 0x41, 0x49, 0x49, 0x7A },
+        { 0x7F, 0x08, 0x08, 0x08, 0x7F }, { 0x00, 0x41, 0x7F, 0x41, 0x00 }, { 0x20, 0x40, 0x41, 0x3F, 0x01 }, { 0x7F, 0x08, 0x14, 0x22, 0x41 },
+        { 0x7F, 0x40, 0x40, 0x40, 0x40 }, { 0x7F, 0x02, 0x0C, 0x02, 0x7F }, { 0x7F, 0x04, 0x08, 0x10, 0x7F }, { 0x3E, 0x41, 0x41, 0x41, 0x3E },
+        { 0x7F, 0x09, 0x09, 0x09, 0x06 }, { 0x3E, 0x41, 0x51, 0x21, 0x5E }, { 0x7F, 0x09, 0x19, 0x29, 0x46 }, { 0x46, 0x49, 0x49, 0x49, 0x31 },
+        { 0x01, 0x01, 0x7F, 0x01, 0x01 }, { 0x3F, 0x40, 0x40, 0x40, 0x3F }, { 0x1F, 0x20, 0x40, 0x20, 0x1F }, { 0x3F, 0x40, 0x38, 0x40, 0x3F },
+        { 0x63, 0x14, 0x08, 0x14, 0x63 }, { 0x07, 0x08, 0x70, 0x08, 0x07 }, { 0x61, 0x51, 0x49, 0x45, 0x43 }, { 0x00, 0x7F, 0x41, 0x41, 0x00 },
+        { 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x7F, 0x00 }, { 0x04, 0x02, 0x01, 0x02, 0x04 }, { 0x40, 0x40, 0x40, 0x40, 0x40 },
+        { 0x00, 0x01, 0x02, 0x04, 0x00 }, { 0x20, 0x54, 0x54, 0x54, 0x78 }, { 0x7F, 0x48, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x20 },
+        { 0x38, 0x44, 0x44, 0x48, 0x7F }, { 0x38, 0x54, 0x54, 0x54, 0x18 }, { 0x08, 0x7E, 0x09, 0x01, 0x02 }, { 0x0C, 0x52, 0x52, 0x52, 0x3E },
+        { 0x7F, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7D, 0x40, 0x00 }, { 0x20, 0x40, 0x44, 0x3D, 0x00 }, { 0x7F, 0x10, 0x28, 0x44, 0x00 },
+        { 0x00, 0x41, 0x7F, 0x40, 0x00 }, { 0x7C, 0x04, 0x18, 0x04, 0x78 }, { 0x7C, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 },
+        { 0x7C, 0x14, 0x14, 0x14, 0x08 }, { 0x08, 0x14, 0x14, 0x18, 0x7C }, { 0x7C, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x20 },
+        { 0x04, 0x3F, 0x44, 0x40, 0x20 }, { 0x3C, 0x40, 0x40, 0x20, 0x7C }, { 0x1C, 0x20, 0x40, 0x20, 0x1C }, { 0x3C, 0x40, 0x30, 0x40, 0x3C },
+        { 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x0C, 0x50, 0x50, 0x50, 0x3C }, { 0x44, 0x64, 0x54, 0x4C, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 },
+        { 0x00, 0x00, 0x7F, 0x00, 0x00 }, { 0x00, 0x41, 0x36, 0x08, 0x00 }, { 0x08, 0x04, 0x08, 0x10, 0x08 }
+    };
+
+    // raylib's default font is 10 pixels high, glyphs get scaled up in whole pixels the same way
+    inline int SoftFontScale(int font_size)
+    {
+        return std::max(1, font_size / 10);
+    }
+
+    inline void InitSoftCanvas(SoftCanvas& canvas, int width, int height)
+    {
+        canvas.width = width;
+        canvas.height = height;
+        canvas.pixels.assign(width * height, BLACK);
+        canvas.commands.clear();
+        canvas.text.clear();
+    }
+
+    inline void PushSoftCommand(SoftCanvas& canvas, SoftCommand command)
+    {
+        command.min_x = std::max(command.min_x, 0);
+        command.min_y = std::max(command.min_y, 0);
+        command.max_x = std::min(command.max_x, canvas.width);
+        command.max_y = std::min(command.max_y, canvas.height);
+
+        if (command.min_x < command.max_x && command.min_y < command.max_y)
+        {
+            canvas.commands.push_back(command);
+        }
+    }
+
+    inline void CanvasClear(SoftCanvas& canvas, const Color& color)
+    {
+        // anything recorded before a clear would just get painted over
+        canvas.commands.clear();
+        canvas.text.clear();
+
+        SoftCommand c = {};
+        c.type = SOFT_CLEAR;
+        c.color = color;
+        c.max_x = canvas.width;
+        c.max_y = canvas.height;
+        PushSoftCommand(canvas, c);
+    }
+
+    inline void CanvasCircle(SoftCanvas& canvas, const Vector2& center, float radius, const Color& color)
+    {
+        SoftCommand c = {};
+        c.type = SOFT_CIRCLE;
+        c.x0 = center.x;
+        c.y0 = center.y;
+        c.radius = radius;
+        c.color = color;
+        c.min_x = (int)floorf(center.x - radius);
+        c.min_y = (int)floorf(center.y - radius);
+        c.max_x = (int)ceilf(center.x + radius) + 1;
+        c.max_y = (int)ceilf(center.y + radius) + 1;
+        PushSoftCommand(canvas, c);
+    }
+
+    inline void CanvasCircleLines(SoftCanvas& canvas, const Vector2& center, float radius, const Color& color)
+    {
+        SoftCommand c = {};
+        c.type = SOFT_CIRCLE_LINES;
+        c.x0 = center.x;
+        c.y0 = center.y;
+        c.radius = radius;
+        c.color = color;
+        c.min_x = (int)floorf(center.x - radius) - 1;
+        c.min_y = (int)floorf(center.y - radius) - 1;
+        c.max_x = (int)ceilf(center.x + radius) + 2;
+        c.max_y = (int)ceilf(center.y + radius) + 2;
+        PushSoftCommand(canvas, c);
+    }
+
+    // like raylib's integer lines, the line runs through the middle of the end pixels
+    inline void CanvasLine(SoftCanvas& canvas, const Vector2& start, const Vector2& end, const Color& color)
+    {
+        SoftCommand c = {};
+        c.type = SOFT_LINE;
+        c.x0 = floorf(start.x) + 0.5f;
+        c.y0 = floorf(start.y) + 0.5f;
+        c.x1 = floorf(end.x) + 0.5f;
+        c.y1 = floorf(end.y) + 0.5f;
+        c.color = color;
+        c.min_x = (int)floorf(fminf(c.x0, c.x1)) - 1;
+        c.min_y = (int)floorf(fminf(c.y0, c.y1)) - 1;
+        c.max_x = (int)ceilf(fmaxf(c.x0, c.x1)) + 1;
+        c.max_y = (int)ceilf(fmaxf(c.y0, c.y1)) + 1;
+        PushSoftCommand(canvas, c);
+    }
+
+    inline void CanvasRectangle(SoftCanvas& canvas, int x, int y, int width, int height, const Color& color)
+    {
+        SoftCommand c = {};
+        c.type = SOFT_RECTANGLE;
+        c.color = color;
+        c.min_x = x;
+        c.min_y = y;
+        c.max_x = x + width;
+        c.max_y = y + height;
+        PushSoftCommand(canvas, c);
+    }
+
+    inline void CanvasRectangleLines(SoftCanvas& canvas, int x, int y, int width, int height, const Color& color)
+    {
+        CanvasRectangle(canvas, x, y, width, 1, color);
+        CanvasRectangle(canvas, x, y + height - 1, width, 1, color);
+        CanvasRectangle(canvas, x, y + 1, 1, height - 2, color);
+        CanvasRectangle(canvas, x + width - 1, y + 1, 1, height - 2, color);
+    }
+
+    inline int CanvasTextWidth(SoftCanvas&, const std::string& text, int font_size)
+    {
+        const int scale = SoftFontScale(font_size);
+        return text.empty() ? 0 : (int)text.size() * 6 * scale - scale;
+    }
+
+    inline void CanvasText(SoftCanvas& canvas, const std::string& text, int x, int y, int font_size, const Color& color)
+    {
+        SoftCommand c = {};
+        c.type = SOFT_TEXT;
+        c.x0 = x;
+        c.y0 = y;
+        c.font_size = font_size;
+        c.text_offset = canvas.text.size();
+        c.text_length = text.size();
+        c.color = color;
+        c.min_x = x;
+        c.min_y = y;
+        c.max_x = x + CanvasTextWidth(canvas, text, font_size);
+        c.max_y = y + 7 * SoftFontScale(font_size);
+
+        canvas.text += text;
+        PushSoftCommand(canvas, c);
+    }
+
+    inline int CanvasWidth(SoftCanvas& canvas) { return canvas.width; }
+    inline int CanvasHeight(SoftCanvas& canvas) { return canvas.height; }
+
+    // no camera headless, the world is drawn 1:1
+    inline void CanvasBeginWorld(SoftCanvas&) {}
+    inline void CanvasEndWorld(SoftCanvas&) {}
+
+    // source over, same as raylib's default blend mode
+    inline void BlendPixel(Color& dst, const Color& src)
+    {
+        if (src.a == 255)
+        {
+            dst = src;
+            return;
+        }
+
+        const int a = src.a;
+        dst.r = (src.r * a + dst.r * (255 - a) + 127) / 255;
+        dst.g = (src.g * a + dst.g * (255 - a) + 127) / 255;
+        dst.b = (src.b * a + dst.b * (255 - a) + 127) / 255;
+        dst.a = std::min(255, a + (dst.a * (255 - a) + 127) / 255);
+    }
+
+    // the part of a command inside one tile, [x0, x1) x [y0, y1)
+    inline void RasterizeCommand(SoftCanvas& canvas, const SoftCommand& c, int x0, int y0, int x1, int y1)
+    {
+        for (int y = y0; y < y1; ++y)
+        {
+            Color* row = &canvas.pixels[y * canvas.width];
+            const float py = y + 0.5f;
+
+            for (int x = x0; x < x1; ++x)
+            {
+                const float px = x + 0.5f;
+                bool covered = false;
+
+                switch (c.type)
+                {
+                    case SOFT_CLEAR:
+                    case SOFT_RECTANGLE:
+                        covered = true;
+                        break;
+
+                    case SOFT_CIRCLE:
+                        covered = (px - c.x0) * (px - c.x0) + (py - c.y0) * (py - c.y0) <= c.radius * c.radius;
+                        break;
+
+                    case SOFT_CIRCLE_LINES:
+                    {
+                        float d = sqrtf((px - c.x0) * (px - c.x0) + (py - c.y0) * (py - c.y0));
+                        covered = fabsf(d - c.radius) <= 0.5f;
+                        break;
+                    }
+
+                    case SOFT_LINE:
+                    {
+                        // distance from the pixel centre to the segment
+                        const float dx = c.x1 - c.x0, dy = c.y1 - c.y0;
+                        const float len2 = dx * dx + dy * dy;
+                        float t = len2 > 0.0f ? ((px - c.x0) * dx + (py - c.y0) * dy) / len2 : 0.0f;
+                        t = std::clamp(t, 0.0f, 1.0f);
+                        const float ex = c.x0 + t * dx - px, ey = c.y0 + t * dy - py;
+                        covered = ex * ex + ey * ey <= 0.25f;
+                        break;
+                    }
+
+                    case SOFT_TEXT:
+                    {
+                        const int scale = SoftFontScale(c.font_size);
+                        const int gx = (x - (int)c.x0) / scale;
+                        const int gy = (y - (int)c.y0) / scale;
+                        const int column = gx % 6;
+                        const int ch = (unsigned char)canvas.text[c.text_offset + gx / 6];
+
+                        if (column < 5 && ch >= 32 && ch < 127)
+                        {
+                            covered = (soft_font[ch - 32][column] >> gy) & 1;
+                        }
+                        break;
+                    }
+                }
+
+                if (covered)
+                {
+                    BlendPixel(row[x], c.color);
+                }
+            }
+        }
+    }
+
+    // turns the recorded commands into pixels, every tile draws its commands in the order they were recorded
+    inline void RasterizeSoftCanvas(SoftCanvas& canvas)
+    {
+        const int tiles_x = (canvas.width + canvas.tile_size - 1) / canvas.tile_size;
+        const int tiles_y = (canvas.height + canvas.tile_size - 1) / canvas.tile_size;
+
+        canvas.bins.resize(tiles_x * tiles_y);
+        for (int t = 0; t < canvas.bins.size(); ++t)
+        {
+            canvas.bins[t].clear();
+        }
+
+        for (int i = 0; i < canvas.commands.size(); ++i)
+        {
+            const SoftCommand& c = canvas.commands[i];
+            for (int ty = c.min_y / canvas.tile_size; ty <= (c.max_y - 1) / canvas.tile_size; ++ty)
+            {
+                for (int tx = c.min_x / canvas.tile_size; tx <= (c.max_x - 1) / canvas.tile_size; ++tx)
+                {
+                    canvas.bins[ty * tiles_x + tx].push_back(i);
+                }
+            }
+        }
+
+        Parallel::For(0, tiles_x * tiles_y, [&](int start, int stop, int)
+        {
+            for (int t = start; t < stop; ++t)
+            {
+                const int tile_x0 = (t % tiles_x) * canvas.tile_size;
+                const int tile_y0 = (t / tiles_x) * canvas.tile_size;
+                const int tile_x1 = std::min(tile_x0 + canvas.tile_size, canvas.width);
+                const int tile_y1 = std::min(tile_y0 + canvas.tile_size, canvas.height);
+
+                for (int k = 0; k < canvas.bins[t].size(); ++k)
+                {
+                    const SoftCommand& c = canvas.commands[canvas.bins[t][k]];
+                    RasterizeCommand(canvas, c, std::max(tile_x0, c.min_x), std::max(tile_y0, c.min_y),
+                                     std::min(tile_x1, c.max_x), std::min(tile_y1, c.max_y));
+                }
+            }
+        }, 1);
+
+        canvas.commands.clear();
+        canvas.text.clear();
+    }
+
+    // a view of the pixels as a raylib Image, still owned by the canvas so don't unload it
+    inline Image SoftCanvasImage(SoftCanvas& canvas)
+    {
+        return Image{ canvas.pixels.data(), canvas.width, canvas.height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 };
+    }
+
+    inline bool ExportSoftCanvas(SoftCanvas& canvas, const std::string& path)
+    {
+        return ExportImage(SoftCanvasImage(canvas), path.c_str());
+    }
+
+    typedef struct GoldenResult
+    {
+        bool passed;
+        bool missing;           // there's no reference (or it couldn't be read), which fails
+        int mismatched;         // pixels with a channel off by more than the tolerance
+        int max_difference;
+
+    } GoldenResult;
+
+    // pixel diff against a reference PNG, a missing one fails (writing it is up to the caller, so a
+    // fresh checkout can't pass against whatever it just drew). Mismatched pixels are painted red in
+    // diff_path (if there is one)
+    inline GoldenResult CompareGolden(SoftCanvas& canvas, const std::string& reference_path, const std::string& diff_path, int tolerance, int allowed_mismatches)
+    {
+        GoldenResult result = { false, false, 0, 0 };
+
+        if (!FileExists(reference_path.c_str()))
+        {
+            result.missing = true;
+            result.mismatched = canvas.width * canvas.height;
+            return result;
+        }
+
+        Image reference = LoadImage(reference_path.c_str());
+        if (reference.data == NULL || reference.width != canvas.width || reference.height != canvas.height)
+        {
+            UnloadImage(reference);
+            result.missing = reference.data == NULL;
+            result.mismatched = canvas.width * canvas.height;
+            return result;
+        }
+        ImageFormat(&reference, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+
+        const Color* expected = (const Color*)reference.data;
+        std::vector<Color> diff(canvas.pixels.size());
+
+        for (int i = 0; i < canvas.pixels.size(); ++i)
+        {
+            const Color& a = canvas.pixels[i];
+            const Color& b = expected[i];
+            const int d = std::max(std::max(abs(a.r - b.r), abs(a.g - b.g)), std::max(abs(a.b - b.b), abs(a.a - b.a)));
+
+            result.max_difference = std::max(result.max_difference, d);
+            if (d > tolerance)
+            {
+                ++result.mismatched;
+                diff[i] = RED;
+            }
+            else
+            {
+                // the reference faded out so the red stands out
+                diff[i] = Color{ (unsigned char)(b.r / 4), (unsigned char)(b.g / 4), (unsigned char)(b.b / 4), 255 };
+            }
+        }
+        UnloadImage(reference);
+
+        if (!diff_path.empty() && result.mismatched > 0)
+        {
+            ExportImage(Image{ diff.data(), canvas.width, canvas.height, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8 }, diff_path.c_str());
+        }
+
+        result.passed = result.mismatched <= allowed_mismatches;
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,201 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include "parallel.h"
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+// LSD radix sort of (key, value) pairs split across the thread pool, for 32 or 64 bit unsigned
+// keys. Every pass counts one byte of the keys per chunk, prefix sums the counts into where each
+// chunk writes each byte value, then every chunk scatters its own pairs. Chunks keep their place
+// in the order, so it's stable. The bytes above the highest bit any key has set aren't looked at,
+// and a byte that's the same in every key anyway is found from the counts and its scatter skipped.
+// 64 bit keys that really use more than 48 bits would take 7 or 8 passes, which loses to
+// std::sort, so those go to std::sort instead
+
+namespace Parallel
+{
+    template <typename Key>
+    struct RadixScratch
+    {
+        std::vector<Key> keys;
+        std::vector<int> values;
+        std::vector<int> counts;        // 256 per chunk
+        std::vector<Key> chunk_bits;    // every bit any key in the chunk has set
+
+        typedef struct Entry
+        {
+            Key key;
+            int value;
+            int start;
+
+        } Entry;
+        std::vector<Entry> entries;     // for the std::sort fallback
+    };
+
+    // where passes would cost more than they save, std::sort on the keys with their values and
+    // where they started (for 64 bit keys that fits in the padding a pair would have anyway), the
+    // start breaking ties keeps it as stable as the radix sort
+    template <typename Key>
+    void FallbackSort(std::vector<Key>& keys, std::vector<int>& values, RadixScratch<Key>& scratch)
+    {
+        typedef typename RadixScratch<Key>::Entry Entry;
+
+        const int n = keys.size();
+        scratch.entries.resize(n);
+        for (int i = 0; i < n; ++i)
+        {
+            scratch.entries[i] = Entry{ keys[i], values[i], i };
+        }
+
+        std::sort(scratch.entries.begin(), scratch.entries.end(), [](const Entry& a, const Entry& b)
+        {
+            return a.key < b.key || (a.key == b.key && a.start < b.start);
+        });
+
+        for (int i = 0; i < n; ++i)
+        {
+            keys[i] = scratch.entries[i].key;
+            values[i] = scratch.entries[i].value;
+        }
+    }
+
+    // counts of one byte of the keys in [begin, end), kept to plain loops over arrays so the
+    // compiler can unroll them
+    template <typename Key>
+    inline void CountDigits(const Key* keys, const int begin, const int end, const int shift, int* count)
+    {
+        std::fill(count, count + 256, 0);
+        for (int i = begin; i < end; ++i)
+        {
+            ++count[(keys[i] >> shift) & 255];
+        }
+    }
+
+    template <typename Key>
+    inline void ScatterDigits(const Key* keys, const int* values, const int begin, const int end, const int shift, int* next,
+                              Key* out_keys, int* out_values)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            const int to = next[(keys[i] >> shift) & 255]++;
+            out_keys[to] = keys[i];
+            out_values[to] = values[i];
+        }
+    }
+
+    // sorts keys ascending and moves values along with them (same length), scratch is kept between
+    // calls. The sorted arrays may end up swapped with the scratch ones, so don't hold pointers into them
+    template <typename Key>
+    void RadixSort(std::vector<Key>& keys, std::vector<int>& values, RadixScratch<Key>& scratch)
+    {
+        static_assert(sizeof(Key) == 4 || sizeof(Key) == 8, "32 or 64 bit keys");
+
+        const int n = keys.size();
+        const int chunk_size = 1 << 14;
+        const int chunks = std::max(1, std::min(ThreadCount() * 4, (n + chunk_size - 1) / chunk_size));
+
+        scratch.chunk_bits.resize(chunks);
+
+        For(0, chunks, [&](int c_begin, int c_end, int)
+        {
+            for (int c = c_begin; c < c_end; ++c)
+            {
+                Key bits = 0;
+                for (int i = (long)n * c / chunks; i < (long)n * (c + 1) / chunks; ++i)
+                {
+                    bits |= keys[i];
+                }
+                scratch.chunk_bits[c] = bits;
+            }
+        }, 1);
+
+        // bytes up to the highest set bit
+        Key bits = 0;
+        for (int c = 0; c < chunks; ++c)
+        {
+            bits |= scratch.chunk_bits[c];
+        }
+        int passes = 0;
+        while (passes < sizeof(Key) && (bits >> (8 * passes)) != 0)
+        {
+            ++passes;
+        }
+
+        if (passes > 6)
+        {
+            FallbackSort(keys, values, scratch);
+            return;
+        }
+
+        scratch.keys.resize(n);
+        scratch.values.resize(n);
+        scratch.counts.resize(chunks * 256);
+
+        std::vector<Key>* src_keys = &keys;
+        std::vector<int>* src_values = &values;
+        std::vector<Key>* dst_keys = &scratch.keys;
+        std::vector<int>* dst_values = &scratch.values;
+        int* counts = scratch.counts.data();
+
+        for (int shift = 0; shift < 8 * passes; shift += 8)
+        {
+            const Key* in_keys = src_keys->data();
+
+            For(0, chunks, [&](int c_begin, int c_end, int)
+            {
+                for (int c = c_begin; c < c_end; ++c)
+                {
+                    CountDigits(in_keys, (long)n * c / chunks, (long)n * (c + 1) / chunks, shift, counts + c * 256);
+                }
+            }, 1);
+
+            // every byte value's chunks in order, one after the other
+            int offset = 0;
+            bool all_same = false;
+            for (int digit = 0; digit < 256; ++digit)
+            {
+                const int start = offset;
+                for (int c = 0; c < chunks; ++c)
+                {
+                    const int count = counts[c * 256 + digit];
+                    counts[c * 256 + digit] = offset;
+                    offset += count;
+                }
+                all_same |= offset - start == n;
+            }
+
+            if (all_same)
+            {
+                continue;
+            }
+
+            const int* in_values = src_values->data();
+            Key* out_keys = dst_keys->data();
+            int* out_values = dst_values->data();
+
+            For(0, chunks, [&](int c_begin, int c_end, int)
+            {
+                for (int c = c_begin; c < c_end; ++c)
+                {
+                    ScatterDigits(in_keys, in_values, (long)n * c / chunks, (long)n * (c + 1) / chunks, shift, counts + c * 256, out_keys, out_values);
+                }
+            }, 1);
+
+            std::swap(src_keys, dst_keys);
+            std::swap(src_values, dst_values);
+        }
+
+        // an odd number of passes ends up in the scratch arrays
+        if (src_keys != &keys)
+        {
+            keys.swap(scratch.keys);
+            values.swap(scratch.values);
+        }
+    }
+};
+
+#endif